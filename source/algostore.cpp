@@ -0,0 +1,130 @@
+/**
+ * @file algostore.cpp
+ * @brief Keeps uploaded algorithms in flash, found by a hash of their ELF.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "algostore.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+// Marks a slot whose ELF was completely written; erased flash reads 0xFF.
+constexpr uint32_t SLOT_MAGIC = 0x41445453; // "STDA"
+
+constexpr uint64_t FNV_OFFSET_BASIS = 0xCBF29CE484222325ull;
+constexpr uint64_t FNV_PRIME = 0x00000100000001B3ull;
+
+// ELFs are received and written a piece at a time, in whole write units.
+constexpr size_t CHUNK_SIZE = 64;
+static_assert(CHUNK_SIZE % Flash::WRITE_SIZE == 0 &&
+              AlgorithmStore::HEADER_SIZE % Flash::WRITE_SIZE == 0);
+
+static uint64_t fnv1a(uint64_t hash, const unsigned char *data, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+uint64_t AlgorithmStore::hash(const unsigned char *data, size_t size)
+{
+    return fnv1a(FNV_OFFSET_BASIS, data, size);
+}
+
+const AlgorithmStore::Header *AlgorithmStore::header(unsigned int slot)
+{
+    return reinterpret_cast<const Header *>(Flash::data() + slot * SLOT_SIZE);
+}
+
+int AlgorithmStore::find(uint64_t hash)
+{
+    for (unsigned int i = 0; i < SLOT_COUNT; i++) {
+        if (auto h = header(i); h->magic == SLOT_MAGIC && h->hash == hash)
+            return i;
+    }
+
+    return NO_SLOT;
+}
+
+int AlgorithmStore::store(size_t size, uint64_t hash, ReadFunc read)
+{
+    std::array<unsigned char, CHUNK_SIZE> chunk;
+
+    // An ELF that is already stored is only received (to check its hash),
+    // sparing the flash. Slots are only taken once erased, so an interrupted
+    // store leaves its slot without the magic number and free for the next.
+    const int existing = find(hash);
+    int slot = NO_SLOT;
+    if (existing == NO_SLOT && size > 0 && size <= MAX_ELF_FILE_SIZE) {
+        for (unsigned int i = 0; i < SLOT_COUNT; i++) {
+            if (header(i)->magic != SLOT_MAGIC) {
+                slot = i;
+                break;
+            }
+        }
+    }
+
+    const size_t base = slot * SLOT_SIZE;
+    bool ok = slot != NO_SLOT && Flash::erase(base, SLOT_SIZE);
+    bool received = true;
+    uint64_t received_hash = FNV_OFFSET_BASIS;
+
+    for (size_t offset = 0; offset < size; offset += CHUNK_SIZE) {
+        const auto count = std::min(CHUNK_SIZE, size - offset);
+        if (read(chunk.data(), count) != count) {
+            received = false;
+            break;
+        }
+
+        received_hash = fnv1a(received_hash, chunk.data(), count);
+        if (ok) {
+            std::fill(chunk.begin() + count, chunk.end(), 0xFF);
+            const auto padded = (count + Flash::WRITE_SIZE - 1) / Flash::WRITE_SIZE * Flash::WRITE_SIZE;
+            ok = Flash::write(base + HEADER_SIZE + offset, chunk.data(), padded);
+        }
+    }
+
+    if (!received || received_hash != hash) {
+        if (slot != NO_SLOT)
+            Flash::erase(base, SLOT_SIZE);
+        return NO_SLOT;
+    }
+
+    if (existing != NO_SLOT)
+        return existing;
+    if (!ok)
+        return NO_SLOT;
+
+    // The header goes last, making the slot valid.
+    chunk.fill(0xFF);
+    const Header h { SLOT_MAGIC, static_cast<uint32_t>(size), hash };
+    std::memcpy(chunk.data(), &h, sizeof(h));
+    if (!Flash::write(base, chunk.data(), HEADER_SIZE))
+        return NO_SLOT;
+
+    return slot;
+}
+
+bool AlgorithmStore::select(unsigned int slot)
+{
+    if (slot >= SLOT_COUNT || header(slot)->magic != SLOT_MAGIC)
+        return false;
+
+    return ELFManager::load(Flash::data() + slot * SLOT_SIZE + HEADER_SIZE,
+                            header(slot)->size);
+}
+
+bool AlgorithmStore::evict(unsigned int slot)
+{
+    return slot < SLOT_COUNT && Flash::erase(slot * SLOT_SIZE, SLOT_SIZE);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file algostore.hpp
+ * @brief Keeps uploaded algorithms in flash, found by a hash of their ELF.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_ALGOSTORE_HPP
+#define STMDSP_ALGOSTORE_HPP
+
+#include "elfload.hpp"
+#include "flash.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+class AlgorithmStore
+{
+public:
+    using ReadFunc = size_t (*)(unsigned char *, size_t);
+
+    // Each slot holds a header, then an ELF file of up to MAX_ELF_FILE_SIZE,
+    // in whole erase units: four 128K slots on the H7, 28 18K slots on the L4.
+    constexpr static size_t HEADER_SIZE = 32;
+    constexpr static size_t SLOT_SIZE =
+        (HEADER_SIZE + MAX_ELF_FILE_SIZE + Flash::ERASE_SIZE - 1) /
+        Flash::ERASE_SIZE * Flash::ERASE_SIZE;
+    constexpr static unsigned int SLOT_COUNT = Flash::SIZE / SLOT_SIZE;
+    constexpr static int NO_SLOT = -1;
+
+    // The 64-bit FNV-1a hash of an ELF file, by which it is found.
+    static uint64_t hash(const unsigned char *data, size_t size);
+
+    // Returns the slot holding the ELF with the given hash, or NO_SLOT.
+    static int find(uint64_t hash);
+    // Stores an ELF of size bytes with the given hash, received through
+    // read, in a free slot. If it is already stored, the slot holding it is
+    // returned without touching the flash. All size bytes are consumed, even
+    // on failure. Returns the slot, or NO_SLOT if none are free or the ELF
+    // does not match the hash.
+    static int store(size_t size, uint64_t hash, ReadFunc read);
+    // Loads the ELF in the given slot (see ELFManager::load()).
+    static bool select(unsigned int slot);
+    // Erases the given slot.
+    static bool evict(unsigned int slot);
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t size;
+        uint64_t hash;
+    };
+
+    static const Header *header(unsigned int slot);
+};
+
+#endif // STMDSP_ALGOSTORE_HPP
@@ -269,19 +269,33 @@ void boardInit(void) {
     //     Region 2: Data for algorithm thread
     //     Region 3: Code for algorithm thread
     //     Region 4: User algorithm code
+    //     Region 5: CORDIC, for the algorithm's direct math calls
+    //     Region 6: User algorithm data (DTCM)
     mpuConfigureRegion(MPU_REGION_2,
                        0x20000000,
                        MPU_RASR_ATTR_AP_RW_RW | MPU_RASR_ATTR_NON_CACHEABLE |
                        MPU_RASR_SIZE_64K |
                        MPU_RASR_ENABLE);
     mpuConfigureRegion(MPU_REGION_3,
-                       0x0807F800,
+                       0x0807C000,
                        MPU_RASR_ATTR_AP_RO_RO | MPU_RASR_ATTR_NON_CACHEABLE |
-                       MPU_RASR_SIZE_2K |
+                       MPU_RASR_SIZE_16K |
                        MPU_RASR_ENABLE);
     mpuConfigureRegion(MPU_REGION_4,
                        0x00000000,
                        MPU_RASR_ATTR_AP_RW_RW | MPU_RASR_ATTR_NON_CACHEABLE |
                        MPU_RASR_SIZE_64K |
                        MPU_RASR_ENABLE);
+    mpuConfigureRegion(MPU_REGION_5,
+                       CORDIC_BASE,
+                       MPU_RASR_ATTR_AP_RW_RW | MPU_RASR_ATTR_SHARED_DEVICE |
+                       MPU_RASR_ATTR_XN |
+                       MPU_RASR_SIZE_1K |
+                       MPU_RASR_ENABLE);
+    mpuConfigureRegion(MPU_REGION_6,
+                       0x20018000,
+                       MPU_RASR_ATTR_AP_RW_RW | MPU_RASR_ATTR_NON_CACHEABLE |
+                       MPU_RASR_ATTR_XN |
+                       MPU_RASR_SIZE_32K |
+                       MPU_RASR_ENABLE);
 }
@@ -295,9 +295,9 @@ void boardInit(void) {
                        MPU_RASR_SIZE_128K |
                        MPU_RASR_ENABLE);
     mpuConfigureRegion(MPU_REGION_3,
-                       0x0807F800,
+                       0x0807C000,
                        MPU_RASR_ATTR_AP_RO_RO | MPU_RASR_ATTR_NON_CACHEABLE |
-                       MPU_RASR_SIZE_2K |
+                       MPU_RASR_SIZE_16K |
                        MPU_RASR_ENABLE);
     mpuConfigureRegion(MPU_REGION_4,
                        0x10000000,
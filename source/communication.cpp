@@ -6,13 +6,18 @@
 #include "periph/adc.hpp"
 #include "periph/dac.hpp"
 #include "periph/usbserial.hpp"
+#include "algostore.hpp"
 #include "elfload.hpp"
 #include "error.hpp"
+#include "lz4.hpp"
+#include "messagelog.hpp"
+#include "parameters.hpp"
 #include "conversion.hpp"
 #include "runstatus.hpp"
 #include "samples.hpp"
 
 #include <algorithm>
+#include <array>
 #include <tuple>
 
 __attribute__((section(".stacks")))
@@ -29,10 +34,20 @@ void CommunicationManager::begin()
 
 static void writeADCBuffer(unsigned char *);
 static void setBufferSize(unsigned char *);
+static void conversionMode(unsigned char *);
 static void updateGenerator(unsigned char *);
+static void storeAlgorithm(unsigned char *);
+static void findStoredAlgorithm(unsigned char *);
 static void loadAlgorithm(unsigned char *);
+static void loadStoredAlgorithm(unsigned char *);
+static void loadCompressedAlgorithm(unsigned char *);
 static void readStatus(unsigned char *);
+static void readConversionStats(unsigned char *);
 static void measureConversion(unsigned char *);
+static void bufferDepth(unsigned char *);
+static void overrunPolicy(unsigned char *);
+static void evictStoredAlgorithm(unsigned char *);
+static void writeParameters(unsigned char *);
 static void startConversion(unsigned char *);
 static void stopConversion(unsigned char *);
 static void startGenerator(unsigned char *);
@@ -43,25 +58,37 @@ static void readIdentifier(unsigned char *);
 static void readExecTime(unsigned char *);
 static void sampleRate(unsigned char *);
 static void readConversionResults(unsigned char *);
+static void readParameters(unsigned char *);
 static void readConversionInput(unsigned char *);
 static void readMessage(unsigned char *);
 static void stopGenerator(unsigned char *);
 
-static const std::array<std::pair<char, void (*)(unsigned char *)>, 19> commandTable {{
+static const std::array<std::pair<char, void (*)(unsigned char *)>, 30> commandTable {{
     {'A', writeADCBuffer},
     {'B', setBufferSize},
+    {'C', conversionMode},
     {'D', updateGenerator},
     {'E', loadAlgorithm},
+    {'F', storeAlgorithm},
+    {'H', findStoredAlgorithm},
     {'I', readStatus},
+    {'L', loadStoredAlgorithm},
     {'M', measureConversion},
+    {'N', bufferDepth},
+    {'O', overrunPolicy},
+    {'P', writeParameters},
     {'R', startConversion},
     {'S', stopConversion},
+    {'T', readConversionStats},
     {'W', startGenerator},
+    {'X', evictStoredAlgorithm},
+    {'Z', loadCompressedAlgorithm},
     {'a', readADCBuffer},
     {'d', readDACBuffer},
     {'e', unloadAlgorithm},
     {'i', readIdentifier},
     {'m', readExecTime},
+    {'p', readParameters},
     {'r', sampleRate},
     {'s', readConversionResults},
     {'t', readConversionInput},
@@ -87,6 +114,19 @@ void CommunicationManager::threadComm(void *)
     }
 }
 
+// Reads and drops a refused command's payload, so that it is not taken for
+// commands.
+static void discard(size_t size)
+{
+    unsigned char chunk[64];
+    while (size > 0) {
+        auto count = std::min(size, sizeof(chunk));
+        if (USBSerial::read(chunk, count) != count)
+            break;
+        size -= count;
+    }
+}
+
 void writeADCBuffer(unsigned char *)
 {
     USBSerial::read(Samples::In.bytedata(), Samples::In.bytesize());
@@ -97,9 +137,9 @@ void setBufferSize(unsigned char *cmd)
     if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle) &&
         EM.assert(USBSerial::read(&cmd[1], 2) == 2, Error::BadParamSize))
     {
-        // count is multiplied by two since this command receives size of buffer
-        // for each algorithm application.
-        unsigned int count = (cmd[1] | (cmd[2] << 8)) * 2;
+        // count is multiplied by the slot count since this command receives
+        // size of buffer for each algorithm application.
+        unsigned int count = (cmd[1] | (cmd[2] << 8)) * Samples::In.slots();
         if (EM.assert(count <= MAX_SAMPLE_BUFFER_SIZE, Error::BadParam)) {
             Samples::In.setSize(count);
             Samples::Out.setSize(count);
@@ -107,6 +147,21 @@ void setBufferSize(unsigned char *cmd)
     }
 }
 
+void conversionMode(unsigned char *cmd)
+{
+    if (EM.assert(USBSerial::read(&cmd[1], 1) == 1, Error::BadParamSize)) {
+        if (cmd[1] == 0xFF) {
+            unsigned char m = static_cast<unsigned char>(ConversionManager::getMode());
+            USBSerial::write(&m, 1);
+        } else if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle) &&
+                   EM.assert(cmd[1] < static_cast<unsigned char>(ConversionMode::Count),
+                             Error::BadParam))
+        {
+            ConversionManager::setMode(static_cast<ConversionMode>(cmd[1]));
+        }
+    }
+}
+
 void updateGenerator(unsigned char *cmd)
 {
     if (EM.assert(USBSerial::read(&cmd[1], 2) == 2, Error::BadParamSize)) {
@@ -136,15 +191,140 @@ void updateGenerator(unsigned char *cmd)
 
 void loadAlgorithm(unsigned char *cmd)
 {
-    if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle) &&
-        EM.assert(USBSerial::read(&cmd[1], 2) == 2, Error::BadParamSize))
+    // Loading while running switches to the new algorithm between blocks.
+    if (EM.assert(USBSerial::read(&cmd[1], 2) == 2, Error::BadParamSize)) {
+        // The ELF is loaded as it arrives, so its size is only limited by
+        // the memory its segments are loaded to. A fixed-address ELF must
+        // have its section headers and symbol tables in its last
+        // MAX_ELF_TAIL_SIZE (4K) bytes, or it fails with BadUserCodeSymbols
+        // as well (see elfload.hpp).
+        unsigned int size = cmd[1] | (cmd[2] << 8);
+        auto success = ELFManager::load(size, USBSerial::read);
+        EM.assert(success, Error::BadUserCodeLoad);
+    }
+}
+
+// Compressed uploads come in pieces of up to this many bytes, each its own
+// LZ4 block, so that only one piece is held while the ELF is loaded.
+constexpr unsigned int COMPRESSED_PIECE_SIZE = 2048;
+
+static std::array<unsigned char, COMPRESSED_PIECE_SIZE> piece;
+static unsigned int piece_offset = 0;
+static unsigned int piece_size = 0;
+static unsigned int compressed_left = 0;
+
+// Reads a compressed upload's ELF, decompressing each piece as it is needed.
+// Returns short if a piece is malformed or the upload runs out.
+static size_t readCompressed(unsigned char *dst, size_t count)
+{
+    size_t done = 0;
+    while (done < count) {
+        if (piece_offset == piece_size) {
+            // Each piece is its compressed size (16 bits), then its block.
+            unsigned char header[2];
+            if (compressed_left < 2 || USBSerial::read(header, 2) != 2)
+                break;
+            compressed_left -= 2;
+
+            unsigned int size = header[0] | (header[1] << 8);
+            if (size > compressed_left)
+                break;
+            compressed_left -= size;
+            piece_offset = 0;
+            piece_size = lz4::decompress(piece.data(), piece.size(), size, USBSerial::read);
+            if (piece_size == 0)
+                break;
+        }
+
+        const auto n = std::min<size_t>(count - done, piece_size - piece_offset);
+        std::copy_n(piece.begin() + piece_offset, n, dst + done);
+        piece_offset += n;
+        done += n;
+    }
+
+    return done;
+}
+
+void loadCompressedAlgorithm(unsigned char *)
+{
+    // Takes the compressed and original sizes, followed by the ELF in pieces
+    // (see readCompressed()). The host splits the ELF into pieces of up to
+    // COMPRESSED_PIECE_SIZE bytes and compresses each as a raw LZ4 block.
+    // They are decompressed into the streaming loader as they arrive. The
+    // ELF is limited as for 'E'.
+    if (unsigned char sizes[4]; EM.assert(USBSerial::read(sizes, 4) == 4, Error::BadParamSize)) {
+        compressed_left = sizes[0] | (sizes[1] << 8);
+        unsigned int original = sizes[2] | (sizes[3] << 8);
+        piece_offset = 0;
+        piece_size = 0;
+
+        auto success = ELFManager::load(original, readCompressed);
+        // Keep the command stream in sync.
+        discard(compressed_left);
+        EM.assert(success, Error::BadUserCodeLoad);
+    }
+}
+
+void storeAlgorithm(unsigned char *cmd)
+{
+    // Takes the ELF's size, its hash (as for 'H') and the ELF, and keeps it
+    // in the next free store slot instead of loading it. Replies with the
+    // slot, or 0xFF. Programming flash stalls code running from it, so this
+    // needs idle.
+    uint64_t hash;
+    if (EM.assert(USBSerial::read(&cmd[1], 2) == 2, Error::BadParamSize) &&
+        EM.assert(USBSerial::read(reinterpret_cast<uint8_t *>(&hash), 8) == 8,
+                  Error::BadParamSize))
     {
-        // Only load the binary if it can fit in the memory reserved for it.
         unsigned int size = cmd[1] | (cmd[2] << 8);
-        if (EM.assert(size < MAX_ELF_FILE_SIZE, Error::BadUserCodeSize)) {
-            USBSerial::read(ELFManager::fileBuffer(), size);
-            auto success = ELFManager::loadFromInternalBuffer();
-            EM.assert(success, Error::BadUserCodeLoad);
+        int slot = AlgorithmStore::NO_SLOT;
+        if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle) &&
+            EM.assert(size < MAX_ELF_FILE_SIZE, Error::BadUserCodeSize))
+        {
+            slot = AlgorithmStore::store(size, hash, USBSerial::read);
+            EM.assert(slot != AlgorithmStore::NO_SLOT, Error::BadUserCodeLoad);
+        } else {
+            discard(size);
+        }
+
+        unsigned char s = static_cast<unsigned char>(slot);
+        USBSerial::write(&s, 1);
+    }
+}
+
+void findStoredAlgorithm(unsigned char *)
+{
+    // Takes an ELF's hash (see AlgorithmStore::hash()), little-endian, and
+    // replies with the slot holding that ELF, or 0xFF.
+    if (uint64_t hash; EM.assert(USBSerial::read(reinterpret_cast<uint8_t *>(&hash), 8) == 8,
+                                 Error::BadParamSize))
+    {
+        unsigned char s = static_cast<unsigned char>(AlgorithmStore::find(hash));
+        USBSerial::write(&s, 1);
+    }
+}
+
+void loadStoredAlgorithm(unsigned char *cmd)
+{
+    // Loads the algorithm in the given slot, as 'E' would.
+    if (EM.assert(USBSerial::read(&cmd[1], 1) == 1, Error::BadParamSize)) {
+        auto success = AlgorithmStore::select(cmd[1]);
+        EM.assert(success, Error::BadUserCodeLoad);
+    }
+}
+
+void evictStoredAlgorithm(unsigned char *cmd)
+{
+    // Erases the given slot, or every slot for 0xFF. A loaded algorithm is
+    // unaffected, since it was copied out.
+    if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle) &&
+        EM.assert(USBSerial::read(&cmd[1], 1) == 1, Error::BadParamSize))
+    {
+        if (cmd[1] == 0xFF) {
+            for (unsigned int i = 0; i < AlgorithmStore::SLOT_COUNT; i++)
+                AlgorithmStore::evict(i);
+        } else {
+            EM.assert(AlgorithmStore::evict(cmd[1]), Error::BadParam);
         }
     }
 }
@@ -159,15 +339,84 @@ void readStatus(unsigned char *)
     USBSerial::write(buf, sizeof(buf));
 }
 
+void readConversionStats(unsigned char *)
+{
+    auto stats = ConversionManager::getStats();
+    USBSerial::write(reinterpret_cast<uint8_t *>(&stats), sizeof(stats));
+}
+
 void measureConversion(unsigned char *)
 {
     if (EM.assert(run_status == RunStatus::Running, Error::NotRunning))
         ConversionManager::startMeasurement();
 }
 
+void bufferDepth(unsigned char *cmd)
+{
+    if (EM.assert(USBSerial::read(&cmd[1], 1) == 1, Error::BadParamSize)) {
+        if (cmd[1] == 0xFF) {
+            unsigned char n = Samples::In.slots();
+            USBSerial::write(&n, 1);
+        } else if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle)) {
+            // Slots are handed over a DMA half at a time, so the depth must
+            // be even. The buffer size per algorithm application is kept.
+            unsigned int depth = cmd[1];
+            if (EM.assert(depth >= 2 && depth % 2 == 0 &&
+                          depth <= MAX_SAMPLE_BUFFER_SLOTS &&
+                          Samples::In.slotsize() * depth <= MAX_SAMPLE_BUFFER_SIZE,
+                          Error::BadParam))
+            {
+                Samples::In.setSlots(depth);
+                Samples::Out.setSlots(depth);
+            }
+        }
+    }
+}
+
+void overrunPolicy(unsigned char *cmd)
+{
+    if (EM.assert(USBSerial::read(&cmd[1], 1) == 1, Error::BadParamSize)) {
+        if (cmd[1] == 0xFF) {
+            // Reply with the policy, followed by the overrun count of each
+            // policy.
+            unsigned char p = static_cast<unsigned char>(ConversionManager::getOverrunPolicy());
+            auto& counts = ConversionManager::getOverrunCounts();
+            USBSerial::write(&p, 1);
+            USBSerial::write(reinterpret_cast<const uint8_t *>(counts.data()),
+                             counts.size() * sizeof(uint32_t));
+        } else if (EM.assert(cmd[1] < static_cast<unsigned char>(OverrunPolicy::Count),
+                             Error::BadParam))
+        {
+            ConversionManager::setOverrunPolicy(static_cast<OverrunPolicy>(cmd[1]));
+        }
+    }
+}
+
+void writeParameters(unsigned char *cmd)
+{
+    // Takes an offset and count of parameters, followed by their values.
+    if (EM.assert(USBSerial::read(&cmd[1], 2) == 2, Error::BadParamSize)) {
+        unsigned int offset = cmd[1];
+        unsigned int count = cmd[2];
+        auto size = count * sizeof(uint32_t);
+        if (EM.assert(offset + count <= PARAMETER_COUNT, Error::BadParam)) {
+            std::array<uint32_t, PARAMETER_COUNT> values;
+            if (EM.assert(USBSerial::read(reinterpret_cast<uint8_t *>(values.data()), size) == size,
+                          Error::BadParamSize))
+            {
+                Parameters::write(offset, values.data(), count);
+            }
+        } else {
+            discard(size);
+        }
+    }
+}
+
 void startConversion(unsigned char *)
 {
-    if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle)) {
+    if (EM.assert(run_status == RunStatus::Idle, Error::NotIdle) &&
+        EM.assert(ConversionManager::canStart(), Error::BadParam))
+    {
         run_status = RunStatus::Running;
         ConversionManager::start();
     }
@@ -219,6 +468,12 @@ void readExecTime(unsigned char *)
                      sizeof(rtcnt_t));
 }
 
+void readParameters(unsigned char *)
+{
+    USBSerial::write(reinterpret_cast<const uint8_t *>(Parameters::m_values.data()),
+                     Parameters::m_values.size() * sizeof(uint32_t));
+}
+
 void sampleRate(unsigned char *cmd)
 {
     if (EM.assert(USBSerial::read(&cmd[1], 1) == 1, Error::BadParamSize)) {
@@ -237,11 +492,11 @@ void readConversionResults(unsigned char *)
 {
     if (auto samps = Samples::Out.modified(); samps != nullptr) {
         unsigned char buf[2] = {
-            static_cast<unsigned char>(Samples::Out.size() / 2 & 0xFF),
-            static_cast<unsigned char>(((Samples::Out.size() / 2) >> 8) & 0xFF)
+            static_cast<unsigned char>(Samples::Out.slotsize() & 0xFF),
+            static_cast<unsigned char>((Samples::Out.slotsize() >> 8) & 0xFF)
         };
         USBSerial::write(buf, 2);
-        unsigned int total = Samples::Out.bytesize() / 2;
+        unsigned int total = Samples::Out.slotsize() * sizeof(Sample);
         unsigned int offset = 0;
         unsigned char unused;
         while (total > 512) {
@@ -261,11 +516,11 @@ void readConversionInput(unsigned char *)
 {
     if (auto samps = Samples::In.modified(); samps != nullptr) {
         unsigned char buf[2] = {
-            static_cast<unsigned char>(Samples::In.size() / 2 & 0xFF),
-            static_cast<unsigned char>(((Samples::In.size() / 2) >> 8) & 0xFF)
+            static_cast<unsigned char>(Samples::In.slotsize() & 0xFF),
+            static_cast<unsigned char>((Samples::In.slotsize() >> 8) & 0xFF)
         };
         USBSerial::write(buf, 2);
-        unsigned int total = Samples::In.bytesize() / 2;
+        unsigned int total = Samples::In.slotsize() * sizeof(Sample);
         unsigned int offset = 0;
         unsigned char unused;
         while (total > 512) {
@@ -283,7 +538,7 @@ void readConversionInput(unsigned char *)
 
 void readMessage(unsigned char *)
 {
-    //USBSerial::write(reinterpret_cast<uint8_t *>(userMessageBuffer), userMessageSize);
+    MessageLog::drain();
 }
 
 void stopGenerator(unsigned char *)
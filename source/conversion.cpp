@@ -15,41 +15,73 @@
 #include "periph/dac.hpp"
 #include "elfload.hpp"
 #include "error.hpp"
+#include "parameters.hpp"
 #include "runstatus.hpp"
 #include "samples.hpp"
+#include "sclock.hpp"
+
+#if defined(TARGET_PLATFORM_SIM)
+#include "simulator.hpp"
+#endif
+
+#include <algorithm>
 
 // MSG_* things below are macros rather than constexpr
 // to ensure inlining.
 
-#define MSG_CONVFIRST          (1)
-#define MSG_CONVSECOND         (2)
-#define MSG_CONVFIRST_MEASURE  (3)
-#define MSG_CONVSECOND_MEASURE (4)
+// Messages carry the index of the ring slot to convert, plus one so that
+// no message is zero.
+#define MSG_CONV(slot)       ((slot) + 1)
+#define MSG_MEASURE          (0x100)
+// Sent by start() and stop(), for the runner to call the algorithm's init()
+// and stop() hooks.
+#define MSG_INIT             (0x200)
+#define MSG_STOP             (0x400)
 
-#define MSG_FOR_FIRST(msg)   (msg & 1)
-#define MSG_FOR_MEASURE(msg) (msg > 2)
+#define MSG_SLOT(msg)        ((msg & 0xFF) - 1)
+#define MSG_FOR_MEASURE(msg) (msg & MSG_MEASURE)
+#define MSG_FOR_HOOKS(msg)   (msg & (MSG_INIT | MSG_STOP))
 
 __attribute__((section(".convdata")))
-thread_t *ConversionManager::m_thread_monitor = nullptr;
+ConversionMode ConversionManager::m_mode = ConversionMode::Copy;
+__attribute__((section(".convdata")))
+unsigned int ConversionManager::m_call_size = 0;
+__attribute__((section(".convdata")))
+unsigned int ConversionManager::m_call_slots = 1;
+__attribute__((section(".convdata")))
+unsigned int ConversionManager::m_history = 0;
+__attribute__((section(".convdata")))
+Sample *ConversionManager::m_middle = nullptr;
+__attribute__((section(".convdata")))
+Sample *ConversionManager::m_middle_history = nullptr;
+__attribute__((section(".convdata")))
+unsigned int ConversionManager::m_sample_rate = 0;
+__attribute__((section(".convdata")))
+ELFManager::EntryFunc ConversionManager::m_started = nullptr;
+__attribute__((section(".convdata")))
+ELFManager::Hooks ConversionManager::m_started_hooks;
+__attribute__((section(".convdata")))
+ConversionManager::BlockBuffer ConversionManager::m_block_buffer = {};
+OverrunPolicy ConversionManager::m_overrun_policy = OverrunPolicy::Abort;
+OverrunCounts ConversionManager::m_overrun_counts = {};
+
+ConversionStats ConversionManager::m_stats = {};
+uint64_t ConversionManager::m_stats_total = 0;
+bool ConversionManager::m_block_running = false;
+rtcnt_t ConversionManager::m_block_start = 0;
+
 thread_t *ConversionManager::m_thread_runner = nullptr;
 
-__attribute__((section(".stacks")))
-std::array<char, 1024> ConversionManager::m_thread_monitor_stack = {};
 __attribute__((section(".stacks")))
 std::array<char, THD_WORKING_AREA_SIZE(128)> ConversionManager::m_thread_runner_entry_stack = {};
 __attribute__((section(".convdata")))
 std::array<char, CONVERSION_THREAD_STACK_SIZE> ConversionManager::m_thread_runner_stack = {};
 
-std::array<msg_t, 2> ConversionManager::m_mailbox_buffer;
+std::array<msg_t, MAX_SAMPLE_BUFFER_SLOTS> ConversionManager::m_mailbox_buffer;
 mailbox_t ConversionManager::m_mailbox = _MAILBOX_DATA(m_mailbox, m_mailbox_buffer.data(), m_mailbox_buffer.size());
 
 void ConversionManager::begin()
 {
-    m_thread_monitor = chThdCreateStatic(m_thread_monitor_stack.data(),
-                                         m_thread_monitor_stack.size(),
-                                         NORMALPRIO + 1,
-                                         threadMonitor,
-                                         nullptr);
     auto runner_stack_end = &m_thread_runner_stack[CONVERSION_THREAD_STACK_SIZE];
     m_thread_runner = chThdCreateStatic(m_thread_runner_entry_stack.data(),
                                         m_thread_runner_entry_stack.size(),
@@ -60,7 +92,25 @@ void ConversionManager::begin()
 
 void ConversionManager::start()
 {
+    // Unless the algorithm asks otherwise, it is called once per slot.
+    const auto slotsize = Samples::In.slotsize();
+    m_call_size = ELFManager::blockSize() != 0 ? ELFManager::blockSize() : slotsize;
+    m_call_slots = m_call_size > slotsize ? m_call_size / slotsize : 1;
+
+    m_overrun_counts = {};
+    m_stats = {};
+    m_stats.period = SClock::getPeriodCycles() * slotsize * m_call_slots;
+    m_stats_total = 0;
+    m_history = ELFManager::historySize();
+    m_sample_rate = SClock::getFrequency();
+    Samples::In.setGuard(m_history);
+    Samples::In.clear();
     Samples::Out.clear();
+    m_middle = Samples::In.middata();
+    m_middle_history = Samples::In.data() + Samples::In.size();
+
+    // The runner has priority, so init() is done with before sampling starts.
+    chMBPostTimeout(&m_mailbox, MSG_INIT, TIME_INFINITE);
     ADC::start(Samples::In.data(), Samples::In.size(), adcReadHandler);
     DAC::start(0, Samples::Out.data(), Samples::Out.size());
 }
@@ -74,19 +124,154 @@ void ConversionManager::stop()
 {
     DAC::stop(0);
     ADC::stop();
+    Samples::In.setGuard(0);
+
+    // The runner has priority, so stop() is done with before this returns
+    // (and before another algorithm can be loaded over this one).
+    chMBPostTimeout(&m_mailbox, MSG_STOP, TIME_INFINITE);
+}
+
+void ConversionManager::setMode(ConversionMode mode)
+{
+    m_mode = mode;
+}
+
+ConversionMode ConversionManager::getMode()
+{
+    return m_mode;
+}
+
+bool ConversionManager::canStart()
+{
+    // A block must either divide a slot, or be made of whole slots that
+    // divide the half of the ring each DMA interrupt completes.
+    const auto slotsize = Samples::In.slotsize();
+    const auto block = ELFManager::blockSize() != 0 ? ELFManager::blockSize() : slotsize;
+    if (block < slotsize) {
+        if (slotsize % block != 0)
+            return false;
+    } else if (block % slotsize != 0 || (Samples::In.slots() / 2) % (block / slotsize) != 0) {
+        return false;
+    }
+
+    // Algorithms that ask for history read it from the input ring in place,
+    // so the samples must be left unconverted. History from the other DMA
+    // half is copied as each half is handed over (see saveHistory()), so the
+    // ring needs room for a copy in front of it and another after it, and
+    // blocks must fit in the block buffer with their history.
+    const auto history = ELFManager::historySize();
+    if (history > 0 && (history > Samples::In.size() / 2 ||
+                        Samples::In.size() + history * 2 + 1 > MAX_SAMPLE_BUFFER_SIZE ||
+                        history + block > sizeof(m_block_buffer.samples) / sizeof(Sample) ||
+                        m_mode == ConversionMode::Float || m_mode == ConversionMode::Q15))
+    {
+        return false;
+    }
+
+    if (m_mode == ConversionMode::Float)
+        return block <= MAX_FLOAT_BLOCK_SIZE;
+    else if (m_mode == ConversionMode::Q15)
+        return block <= MAX_Q15_BLOCK_SIZE;
+    else
+        return true;
 }
 
-thread_t *ConversionManager::getMonitorHandle()
+bool ConversionManager::canSwitchTo(unsigned int block_size, unsigned int history_size)
 {
-    return m_thread_monitor;
+    const auto block = block_size != 0 ? block_size : Samples::In.slotsize();
+    return block == m_call_size && history_size == m_history;
 }
 
-void ConversionManager::abort(bool fpu_stacked)
+void ConversionManager::setOverrunPolicy(OverrunPolicy policy)
+{
+    m_overrun_policy = policy;
+}
+
+OverrunPolicy ConversionManager::getOverrunPolicy()
+{
+    return m_overrun_policy;
+}
+
+const OverrunCounts& ConversionManager::getOverrunCounts()
+{
+    return m_overrun_counts;
+}
+
+ConversionStats ConversionManager::getStats()
+{
+    chSysLock();
+    auto stats = m_stats;
+    if (stats.count > 0)
+        stats.mean = m_stats_total / stats.count;
+    chSysUnlock();
+    return stats;
+}
+
+static inline rtcnt_t cycleCount()
+{
+#if defined(TARGET_PLATFORM_SIM)
+    return sim::cycleCount();
+#else
+    return chSysGetRealtimeCounterX();
+#endif
+}
+
+msg_t ConversionManager::waitForConversion()
+{
+    // The runner only comes back here once it is done with a block, so the
+    // time since we last returned is that block's execution time (including
+    // the output copy, if any).
+    if (m_block_running) {
+        recordBlockTime(cycleCount() - m_block_start);
+        m_block_running = false;
+    }
+
+    msg_t message;
+    if (chMBFetchTimeout(&m_mailbox, &message, TIME_INFINITE) != MSG_OK)
+        message = 0;
+
+    // Slots that only start a multi-slot block take no time to handle.
+    // Parameter updates and newly loaded algorithms are taken here, so that
+    // a block never sees half of a batch or runs across a switch.
+    if (message != 0 && !MSG_FOR_HOOKS(message) &&
+        (MSG_SLOT(message) + 1) % m_call_slots == 0)
+    {
+        Parameters::apply();
+        ELFManager::apply();
+        m_block_running = true;
+        m_block_start = cycleCount();
+    }
+    return message;
+}
+
+void ConversionManager::recordBlockTime(uint32_t cycles)
+{
+    chSysLock();
+    m_stats.min = m_stats.count == 0 || cycles < m_stats.min ? cycles : m_stats.min;
+    m_stats.max = cycles > m_stats.max ? cycles : m_stats.max;
+    m_stats.count++;
+    m_stats_total += cycles;
+    if (cycles > m_stats.period)
+        m_stats.misses++;
+    m_stats.histogram[cycles > 0 ? 31 - __builtin_clz(cycles) : 0]++;
+    chSysUnlock();
+}
+
+void ConversionManager::abort([[maybe_unused]] bool fpu_stacked)
 {
     ELFManager::unload();
+    m_block_running = false;
+    // The algorithm is not stopped, as it may be what went wrong.
+    m_started = nullptr;
     EM.add(Error::ConversionAborted);
     //run_status = RunStatus::Recovering;
 
+#if defined(TARGET_PLATFORM_SIM)
+    // The simulated runner only gets here between algorithm calls, so
+    // unloading is enough to stop it.
+    sim::conversionAborted();
+#else
+
     // Confirm that the exception return thread is the algorithm...
     uint32_t *psp;
 	asm("mrs %0, psp" : "=r" (psp));
@@ -113,23 +298,192 @@ void ConversionManager::abort(bool fpu_stacked)
         // Set the new stack pointer.
 	    asm("msr psp, %0" :: "r" (newpsp));
     }
-}
-
-void ConversionManager::threadMonitor(void *)
-{
-    while (1) {
-        msg_t message;
-        msg_t fetch = chMBFetchTimeout(&m_mailbox, &message, TIME_INFINITE);
-        if (fetch == MSG_OK)
-            chMsgSend(m_thread_runner, message);
-    }
+#endif
 }
 
 void ConversionManager::threadRunnerEntry(void *stack)
 {
     ELFManager::unload();
+#if defined(TARGET_PLATFORM_SIM)
+    (void)stack;
+    threadRunner(nullptr);
+#else
     port_unprivileged_jump(reinterpret_cast<uint32_t>(threadRunner),
                            reinterpret_cast<uint32_t>(stack));
+#endif
+}
+
+// Converts 12-bit samples to floats in [-1, 1).
+__attribute__((section(".convcode")))
+static void samplesToFloat(const Sample *src, float *dst, size_t size)
+{
+#if defined(__ARM_FEATURE_DSP)
+    // Centers two samples at once with SSUB16, then has the FPU convert
+    // each halfword from fixed-point with 11 fractional bits (so no multiply
+    // is needed).
+    auto pairs = reinterpret_cast<const uint32_t *>(src);
+    for (size_t i = 0; i < size / 2; i++) {
+        int32_t centered = __SSUB16(pairs[i], 0x08000800);
+        float lo, hi;
+        asm("vmov %0, %2; vcvt.f32.s16 %0, %0, #11\n\t"
+            "vmov %1, %3; vcvt.f32.s16 %1, %1, #11"
+            : "=&t" (lo), "=t" (hi)
+            : "r" (centered), "r" (centered >> 16));
+        dst[i * 2] = lo;
+        dst[i * 2 + 1] = hi;
+    }
+    if (size & 1)
+        dst[size - 1] = (static_cast<int32_t>(src[size - 1]) - 2048) * (1.f / 2048);
+#else
+    for (size_t i = 0; i < size; i++)
+        dst[i] = (static_cast<int32_t>(src[i]) - 2048) * (1.f / 2048);
+#endif
+}
+
+// Converts floats back to 12-bit samples, saturating to [-1, 1).
+__attribute__((section(".convcode")))
+static void floatToSamples(const float *src, Sample *dst, size_t size)
+{
+#if defined(__ARM_FEATURE_DSP)
+    // The FPU converts each value to 16-bit fixed-point with 11 fractional
+    // bits (saturating), then SSAT16 saturates the packed pair to 12 bits and
+    // SADD16 re-centers it.
+    auto pairs = reinterpret_cast<uint32_t *>(dst);
+    for (size_t i = 0; i < size / 2; i++) {
+        float lo = src[i * 2];
+        float hi = src[i * 2 + 1];
+        int32_t a, b;
+        asm("vcvt.s16.f32 %2, %2, #11; vmov %0, %2\n\t"
+            "vcvt.s16.f32 %3, %3, #11; vmov %1, %3"
+            : "=&r" (a), "=r" (b), "+t" (lo), "+t" (hi));
+        pairs[i] = __SADD16(__SSAT16(__PKHBT(a, b, 16), 12), 0x08000800);
+    }
+    if (size & 1) {
+        int32_t v = static_cast<int32_t>(src[size - 1] * 2048);
+        dst[size - 1] = (v < -2048 ? -2048 : (v > 2047 ? 2047 : v)) + 2048;
+    }
+#else
+    for (size_t i = 0; i < size; i++) {
+        int32_t v = static_cast<int32_t>(src[i] * 2048);
+        dst[i] = (v < -2048 ? -2048 : (v > 2047 ? 2047 : v)) + 2048;
+    }
+#endif
+}
+
+// Converts 12-bit samples to Q15. Both conversions work on two samples per
+// word: the shift cannot carry between halfwords, and flipping each sign bit
+// re-centers them.
+__attribute__((section(".convcode")))
+static void samplesToQ15(const Sample *src, int16_t *dst, size_t size)
+{
+    auto in = reinterpret_cast<const uint32_t *>(src);
+    auto out = reinterpret_cast<uint32_t *>(dst);
+    for (size_t i = 0; i < size / 2; i++)
+        out[i] = (in[i] << 4) ^ 0x80008000;
+    if (size & 1)
+        dst[size - 1] = static_cast<int16_t>((src[size - 1] << 4) ^ 0x8000);
+}
+
+// Converts Q15 back to 12-bit samples (truncating).
+__attribute__((section(".convcode")))
+static void q15ToSamples(const int16_t *src, Sample *dst, size_t size)
+{
+    auto in = reinterpret_cast<const uint32_t *>(src);
+    auto out = reinterpret_cast<uint32_t *>(dst);
+    for (size_t i = 0; i < size / 2; i++)
+        out[i] = ((in[i] ^ 0x80008000) >> 4) & 0x0FFF0FFF;
+    if (size & 1)
+        dst[size - 1] = (static_cast<uint16_t>(src[size - 1]) ^ 0x8000) >> 4;
+}
+
+// Calls the algorithm over the given samples in blocks of m_call_size,
+// returning where its results are.
+__attribute__((section(".convcode")))
+Sample *ConversionManager::runBlocks(ELFManager::EntryFunc entry,
+                                     Sample *in, Sample *out, size_t size)
+{
+    if (m_call_size >= size)
+        return runAlgorithm(entry, in, out, size);
+
+    for (size_t offset = 0; offset < size; offset += m_call_size) {
+        auto result = runAlgorithm(entry, in + offset, out + offset, m_call_size);
+        if (result != nullptr && result != out + offset) {
+            for (size_t i = 0; i < m_call_size; i++)
+                out[offset + i] = result[i];
+        }
+    }
+
+    return out;
+}
+
+// Calls the algorithm through the interface selected by m_mode, returning
+// where its results are.
+__attribute__((section(".convcode")))
+Sample *ConversionManager::runAlgorithm(ELFManager::EntryFunc entry,
+                                        Sample *in, Sample *out, size_t size)
+{
+    // History that reaches back across the middle of the ring may already
+    // be refilled by the DMA, so those blocks are staged with the copy that
+    // saveHistory() took instead (canStart() made sure they fit).
+    const bool crosses = m_history > 0 && in >= m_middle && in - m_history < m_middle;
+#if defined(TARGET_PLATFORM_H7)
+    // Algorithms work on zero-wait-state DTCM rather than the sample rings.
+    const bool staged = m_history + size <= sizeof(m_block_buffer.samples) / sizeof(Sample);
+#else
+    const bool staged = crosses;
+#endif
+    if (staged && (m_mode == ConversionMode::Copy || m_mode == ConversionMode::InPlace)) {
+        auto src = in - m_history;
+        const size_t copied = crosses ? m_middle - src : 0;
+        for (size_t i = 0; i < copied; i++)
+            m_block_buffer.samples[i] = m_middle_history[m_history - copied + i];
+        for (size_t i = copied; i < m_history + size; i++)
+            m_block_buffer.samples[i] = src[i];
+        in = m_block_buffer.samples + m_history;
+    }
+
+    if (m_mode == ConversionMode::InPlace) {
+        auto func = reinterpret_cast<ELFManager::InPlaceEntryFunc>(
+            reinterpret_cast<uintptr_t>(entry));
+        func(in, out, size);
+        return out;
+    } else if (m_mode == ConversionMode::Float) {
+        auto func = reinterpret_cast<ELFManager::FloatEntryFunc>(
+            reinterpret_cast<uintptr_t>(entry));
+        samplesToFloat(in, m_block_buffer.floats, size);
+        floatToSamples(func(m_block_buffer.floats, size), out, size);
+        return out;
+    } else if (m_mode == ConversionMode::Q15) {
+        // Converted into the block buffer rather than the output slot, which
+        // the DAC would play out (or repeat) as is if the block ran late.
+        auto func = reinterpret_cast<ELFManager::Q15EntryFunc>(
+            reinterpret_cast<uintptr_t>(entry));
+        samplesToQ15(in, m_block_buffer.q15, size);
+        q15ToSamples(func(m_block_buffer.q15, size), out, size);
+        return out;
+    } else {
+        return entry(in, size);
+    }
+}
+
+// Calls the stop() hook of the algorithm that was started (if any), then the
+// init() hook of the given one, which is started in its place.
+__attribute__((section(".convcode")))
+void ConversionManager::startAlgorithm(ELFManager::EntryFunc entry)
+{
+    if (m_started != nullptr && m_started_hooks.stop != nullptr)
+        m_started_hooks.stop();
+
+    auto& hooks = ELFManager::hooks();
+    m_started = entry;
+    m_started_hooks.init = hooks.init;
+    m_started_hooks.on_param = hooks.on_param;
+    m_started_hooks.stop = hooks.stop;
+
+    // Parameters changed before init() are seen by it.
+    Parameters::notify(nullptr);
+    if (entry != nullptr && hooks.init != nullptr)
+        hooks.init(m_sample_rate, m_call_size);
 }
 
 __attribute__((section(".convcode")))
@@ -138,81 +492,175 @@ void ConversionManager::threadRunner(void *)
     while (1) {
         // Sleep until we receive a mailbox message.
         msg_t message;
+#if defined(TARGET_PLATFORM_SIM)
+        // Same as syscall 0, without the privilege switch.
+        message = waitForConversion();
+#else
         asm("svc 0; mov %0, r0" : "=r" (message));
+#endif
 
-        if (message != 0) {
-            auto samples = MSG_FOR_FIRST(message) ? Samples::In.data()
-                                                  : Samples::In.middata();
-            auto size = Samples::In.size() / 2;
+        if (MSG_FOR_HOOKS(message)) {
+            startAlgorithm(message == MSG_INIT ? ELFManager::loadedElf() : nullptr);
+        } else if (message != 0) {
+            // A block that spans several slots waits for the last of them.
+            unsigned int last = MSG_SLOT(message);
+            if ((last + 1) % m_call_slots != 0)
+                continue;
 
+            auto slot = last + 1 - m_call_slots;
+            auto samples = Samples::In.slot(slot);
+            auto output = Samples::Out.slot(slot);
+            auto slotsize = Samples::In.slotsize();
+            auto size = slotsize * m_call_slots;
+
+            // An algorithm switched to between blocks is started before its
+            // first one, and told of parameter changes before each.
             auto entry = ELFManager::loadedElf();
+            if (entry != m_started)
+                startAlgorithm(entry);
             if (entry) {
+                Parameters::notify(m_started_hooks.on_param);
+#if defined(TARGET_PLATFORM_SIM)
+                // Charge the algorithm's run time to the virtual clock.
+                sim::beginBlock(samples, size);
+                samples = runBlocks(entry, samples, output, size);
+                auto cycles = sim::endBlock();
+                if (MSG_FOR_MEASURE(message)) {
+                    extern time_measurement_t conversion_time_measurement;
+                    conversion_time_measurement.last = cycles;
+                }
+#else
                 // Below, we remember the stack pointer just in case the
                 // loaded algorithm messes things up.
                 uint32_t sp;
 
                 if (!MSG_FOR_MEASURE(message)) {
                     asm("mov %0, sp" : "=r" (sp));
-                    samples = entry(samples, size);
+                    samples = runBlocks(entry, samples, output, size);
                     asm("mov sp, %0" :: "r" (sp));
                     volatile auto testRead = *samples;
                 } else {
                     // Start execution timer:
                     asm("mov %0, sp; eor r0, r0; svc 2" : "=r" (sp));
-                    samples = entry(samples, size);
+                    samples = runBlocks(entry, samples, output, size);
                     // Stop execution timer:
                     asm("mov r0, #1; svc 2; mov sp, %0" :: "r" (sp));
                     volatile auto testRead = *samples;
                 } 
+#endif
             }
 
             // Update the sample out buffer with the transformed samples.
-            if (samples != nullptr) {
-                if (MSG_FOR_FIRST(message))
-                    Samples::Out.modify(samples, size);
-                else
-                    Samples::Out.midmodify(samples, size);
+            // Results that are already in place only need to be marked.
+            if (samples == output) {
+                Samples::Out.setModified(last);
+            } else if (samples != nullptr) {
+                for (unsigned int i = 0; i < m_call_slots; i++)
+                    Samples::Out.modify(slot + i, samples + i * slotsize, slotsize);
             }
         }
     }
 }
 
+// The DMA interrupts at each half of the ring, so each call completes half of
+// the slots. These are queued for the runner in order.
 void ConversionManager::adcReadHandler(adcsample_t *buffer, size_t)
 {
+    saveHistory(buffer != Samples::In.data());
     chSysLockFromISR();
 
-    // If previous request hasn't been handled, then we're going too slow.
-    // We'll need to abort.
-    if (chMBGetUsedCountI(&m_mailbox) > 1) {
-        chMBResetI(&m_mailbox);
-        chMBResumeX(&m_mailbox);
-        chSysUnlockFromISR();
-        abort();
-    } else {
-        // Mark the modified samples as 'fresh' or ready for manipulation.
-        if (buffer == Samples::In.data()) {
-            Samples::In.setModified();
-            chMBPostI(&m_mailbox, MSG_CONVFIRST);
-        } else {
-            Samples::In.setMidmodified();
-            chMBPostI(&m_mailbox, MSG_CONVSECOND);
+    // If the previous half's slots haven't been handled, then we're going
+    // too slow. Either abort, or drop the late slots so that the runner can
+    // catch up.
+    const auto count = Samples::In.slots() / 2;
+    if (chMBGetUsedCountI(&m_mailbox) > count) {
+        if (m_overrun_policy == OverrunPolicy::Abort) {
+            m_overrun_counts[static_cast<unsigned int>(OverrunPolicy::Abort)]++;
+            chMBResetI(&m_mailbox);
+            chMBResumeX(&m_mailbox);
+            chSysUnlockFromISR();
+            abort();
+            return;
+        }
+
+        msg_t late;
+        while (chMBGetUsedCountI(&m_mailbox) > count &&
+               chMBFetchI(&m_mailbox, &late) == MSG_OK)
+        {
+            dropLateSlot(MSG_SLOT(late));
         }
-        chSysUnlockFromISR();
     }
+
+    // Mark the modified samples as 'fresh' or ready for manipulation.
+    const auto first = buffer == Samples::In.data() ? 0 : count;
+    Samples::In.setModified(first + count - 1);
+    for (unsigned int i = 0; i < count; i++)
+        chMBPostI(&m_mailbox, MSG_CONV(first + i));
+    chSysUnlockFromISR();
 }
 
 void ConversionManager::adcReadHandlerMeasure(adcsample_t *buffer, size_t)
 {
+    saveHistory(buffer != Samples::In.data());
     chSysLockFromISR();
-    if (buffer == Samples::In.data()) {
-        Samples::In.setModified();
-        chMBPostI(&m_mailbox, MSG_CONVFIRST_MEASURE);
-    } else {
-        Samples::In.setMidmodified();
-        chMBPostI(&m_mailbox, MSG_CONVSECOND_MEASURE);
+    // Only the first block of this half is measured.
+    const auto count = Samples::In.slots() / 2;
+    const auto first = buffer == Samples::In.data() ? 0 : count;
+    Samples::In.setModified(first + count - 1);
+    for (unsigned int i = 0; i < count; i++) {
+        chMBPostI(&m_mailbox, i == m_call_slots - 1 ? MSG_CONV(first + i) | MSG_MEASURE
+                                                    : MSG_CONV(first + i));
     }
     chSysUnlockFromISR();
 
     ADC::setOperation(adcReadHandler);
 }
 
+// Copies the history in front of the half just handed over, before the DMA
+// refills it: the end of the ring goes in front of the ring, and the end of
+// the first half goes after the ring (see runAlgorithm()). This is done here
+// rather than by the runner, so that it happens even if slots are dropped,
+// and however far behind the runner is.
+void ConversionManager::saveHistory(bool second)
+{
+    if (m_history == 0)
+        return;
+
+    auto src = second ? m_middle - m_history
+                      : Samples::In.data() + Samples::In.size() - m_history;
+    auto dst = second ? m_middle_history : Samples::In.data() - m_history;
+    std::copy(src, src + m_history, dst);
+}
+
+// Fills in the output of a slot that the runner will not get to in time.
+// Blocks that span several slots are dropped (and counted) as a whole, with
+// their last slot.
+void ConversionManager::dropLateSlot(unsigned int slot)
+{
+    if ((slot + 1) % m_call_slots != 0)
+        return;
+
+    for (auto i = slot + 1 - m_call_slots; i <= slot; i++)
+        dropSlot(i);
+    m_overrun_counts[static_cast<unsigned int>(m_overrun_policy)]++;
+}
+
+void ConversionManager::dropSlot(unsigned int slot)
+{
+    switch (m_overrun_policy) {
+    case OverrunPolicy::Repeat:
+        {
+            auto previous = slot > 0 ? slot - 1 : Samples::Out.slots() - 1;
+            Samples::Out.modify(slot, Samples::Out.slot(previous), Samples::Out.slotsize());
+        }
+        break;
+    case OverrunPolicy::Bypass:
+        Samples::Out.modify(slot, Samples::In.slot(slot), Samples::Out.slotsize());
+        break;
+    case OverrunPolicy::Silence:
+        Samples::Out.clear(slot);
+        break;
+    default:
+        break;
+    }
+}
@@ -15,15 +15,74 @@
 #include "ch.h"
 #include "hal.h"
 
+#include "elfload.hpp"
+
 #include <array>
 
 constexpr unsigned int CONVERSION_THREAD_STACK_SIZE = 
 #if defined(TARGET_PLATFORM_H7)
-                                                  62 * 1024;
+                                                  46 * 1024;
+#else
+                                                  11 * 1024;
+#endif
+
+// Largest block size supported by ConversionMode::Float. The float buffer
+// shares the unprivileged data region with the runner's stack.
+constexpr unsigned int MAX_FLOAT_BLOCK_SIZE =
+#if defined(TARGET_PLATFORM_H7)
+                                          4096;
 #else
-                                                  15 * 1024;
+                                          1024;
 #endif
 
+// Largest block size supported by ConversionMode::Q15, which converts into
+// the same buffer.
+constexpr unsigned int MAX_Q15_BLOCK_SIZE = MAX_FLOAT_BLOCK_SIZE * sizeof(float) / sizeof(int16_t);
+
+// How the runner hands sample blocks to the loaded algorithm.
+enum class ConversionMode : unsigned char
+{
+    // Sample *process(Sample *in, size_t size): returned samples are copied
+    // to the output buffer.
+    Copy = 0,
+    // void process(const Sample *in, Sample *out, size_t size): results are
+    // written straight into the output (DAC) buffer.
+    InPlace,
+    // float *process(float *in, size_t size): samples are given as floats
+    // in [-1, 1), and results are saturated back to that range.
+    Float,
+    // int16_t *process(int16_t *in, size_t size): samples are given as Q15
+    // (see q15.hpp and services.hpp for firmware filters that take them).
+    Q15,
+    Count
+};
+
+// What to do when the algorithm falls behind the ADC.
+enum class OverrunPolicy : unsigned char
+{
+    Abort = 0, // Unload the algorithm (the default).
+    Repeat,    // Drop late blocks, repeating the output block before them.
+    Bypass,    // Drop late blocks, passing their input through.
+    Silence,   // Drop late blocks, outputting silence.
+    Count
+};
+
+// Execution time statistics over every converted block, in core cycles.
+struct ConversionStats
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t mean;
+    // Cycles available per block, and the number of blocks that took longer.
+    uint32_t period;
+    uint32_t misses;
+    // histogram[i] counts blocks that took [2^i, 2^(i + 1)) cycles.
+    std::array<uint32_t, 32> histogram;
+};
+
+using OverrunCounts = std::array<uint32_t, static_cast<unsigned int>(OverrunPolicy::Count)>;
+
 class ConversionManager
 {
 public:
@@ -36,27 +95,87 @@ public:
     // Stops conversion.
     static void stop();
 
-    static thread_t *getMonitorHandle();
+    // Selects the algorithm interface (only changed while idle).
+    static void setMode(ConversionMode mode);
+    static ConversionMode getMode();
+    // Checks that the buffer size is supported by the conversion mode and
+    // the loaded algorithm's block size.
+    static bool canStart();
+    // Checks that an algorithm with the given block and history sizes can
+    // take over the running conversion, which was set up for the sizes of
+    // the algorithm it was started with.
+    static bool canSwitchTo(unsigned int block_size, unsigned int history_size);
+
+    // Selects how overruns are handled (may be changed at any time).
+    static void setOverrunPolicy(OverrunPolicy policy);
+    static OverrunPolicy getOverrunPolicy();
+    // Aborts, or blocks dropped, under each policy since conversion started.
+    static const OverrunCounts& getOverrunCounts();
+    // Block execution time statistics since conversion was started.
+    static ConversionStats getStats();
 
+    // Internal only: Waits for the next slot to convert (returns zero if
+    // the wait was interrupted by an abort).
+    static msg_t waitForConversion();
     // Internal only: Aborts a running conversion.
     static void abort(bool fpu_stacked = true);
 
 private:
-    static void threadMonitor(void *);
     static void threadRunnerEntry(void *stack);
 
     static void threadRunner(void *);
+    static void startAlgorithm(ELFManager::EntryFunc entry);
+    static Sample *runBlocks(ELFManager::EntryFunc entry, Sample *in, Sample *out, size_t size);
+    static Sample *runAlgorithm(ELFManager::EntryFunc entry, Sample *in, Sample *out, size_t size);
     static void adcReadHandler(adcsample_t *buffer, size_t);
     static void adcReadHandlerMeasure(adcsample_t *buffer, size_t);
+    static void saveHistory(bool second);
+    static void dropLateSlot(unsigned int slot);
+    static void dropSlot(unsigned int slot);
+    static void recordBlockTime(uint32_t cycles);
+
+    static ConversionMode m_mode;
+    // Samples per algorithm call, and ring slots per call (more than one
+    // when the algorithm's block spans several slots).
+    static unsigned int m_call_size;
+    static unsigned int m_call_slots;
+    // Past input samples kept in front of the input ring (see canStart()).
+    static unsigned int m_history;
+    // The middle of the input ring, and the copy of the history in front of
+    // it (kept after the ring).
+    static Sample *m_middle;
+    static Sample *m_middle_history;
+    static unsigned int m_sample_rate;
+    // The algorithm whose init() the runner last called, and its hooks. The
+    // runner calls its stop() when it changes.
+    static ELFManager::EntryFunc m_started;
+    static ELFManager::Hooks m_started_hooks;
+    // Holds the floats of ConversionMode::Float, and the Q15 samples of
+    // ConversionMode::Q15. On the H7, the other modes
+    // copy each block (and its history) in here first, as this is DTCM and
+    // the sample rings are in AHB SRAM, where the DMA can reach them. Plain
+    // arrays, since std::array's accessors are not inlined at -O0 and would
+    // live outside of the runner's reach in .text.
+    union BlockBuffer {
+        float floats[MAX_FLOAT_BLOCK_SIZE];
+        Sample samples[MAX_FLOAT_BLOCK_SIZE * sizeof(float) / sizeof(Sample)];
+        int16_t q15[MAX_Q15_BLOCK_SIZE];
+    };
+    static BlockBuffer m_block_buffer;
+    static OverrunPolicy m_overrun_policy;
+    static OverrunCounts m_overrun_counts;
+
+    static ConversionStats m_stats;
+    static uint64_t m_stats_total;
+    static bool m_block_running;
+    static rtcnt_t m_block_start;
 
-    static thread_t *m_thread_monitor;
     static thread_t *m_thread_runner;
 
-    static std::array<char, 1024> m_thread_monitor_stack;
     static std::array<char, THD_WORKING_AREA_SIZE(128)> m_thread_runner_entry_stack;
     static std::array<char, CONVERSION_THREAD_STACK_SIZE> m_thread_runner_stack;
 
-    static std::array<msg_t, 2> m_mailbox_buffer;
+    static std::array<msg_t, MAX_SAMPLE_BUFFER_SLOTS> m_mailbox_buffer;
     static mailbox_t m_mailbox;
 };
 
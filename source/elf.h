@@ -12,6 +12,15 @@
 
 #define EI_NIDENT 16
 
+#define ET_NONE 0
+#define ET_REL  1
+#define ET_EXEC 2
+#define ET_DYN  3
+
+#define EM_386    3
+#define EM_ARM    40
+#define EM_X86_64 62
+
 #define PT_NULL     0
 #define PT_LOAD     1
 #define PT_DYNAMIC  2
@@ -21,14 +30,73 @@
 #define PT_PHDR     6
 #define PT_RESERVED 0x70000000
 
+#define SHT_NULL     0
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB   2
+#define SHT_STRTAB   3
+#define SHT_RELA     4
+#define SHT_NOBITS   8
+#define SHT_REL      9
+#define SHT_DYNSYM   11
+
+#define DT_NULL     0
+#define DT_PLTRELSZ 2
+#define DT_HASH     4
+#define DT_STRTAB   5
+#define DT_SYMTAB   6
+#define DT_RELA     7
+#define DT_RELASZ   8
+#define DT_STRSZ    10
+#define DT_REL      17
+#define DT_RELSZ    18
+#define DT_PLTREL   20
+#define DT_JMPREL   23
+#define DT_GNU_HASH 0x6ffffef5
+
+#define SHF_WRITE     0x1
+#define SHF_ALLOC     0x2
+#define SHF_EXECINSTR 0x4
+
+#define SHN_UNDEF 0
+#define SHN_ABS   0xfff1
+
 #define ELF32_ST_BIND(i)    ((i) >> 4)
 #define ELF32_ST_TYPE(i)    ((i) & 0xF)
 #define ELF32_ST_INFO(b, t) (((b) << 4) + ((t) & 0xF))
 
+#define STB_LOCAL  0
+#define STB_GLOBAL 1
+#define STB_WEAK   2
+
+#define STT_NOTYPE 0
+#define STT_OBJECT 1
+#define STT_FUNC   2
+
 #define ELF32_R_SYM(i)     ((i) >> 8)
 #define ELF32_R_TYPE(i)    ((i) & 0xFF)
 #define ELF32_R_INFO(s, t) (((s) << 8) + ((t) & 0xFF))
 
+#define R_ARM_NONE      0
+#define R_ARM_ABS32     2
+#define R_ARM_REL32     3
+#define R_ARM_GLOB_DAT  21
+#define R_ARM_JUMP_SLOT 22
+#define R_ARM_RELATIVE  23
+
+#define R_386_NONE     0
+#define R_386_32       1
+#define R_386_PC32     2
+#define R_386_GLOB_DAT 6
+#define R_386_JMP_SLOT 7
+#define R_386_RELATIVE 8
+
+#define R_X86_64_NONE      0
+#define R_X86_64_PC32      2
+#define R_X86_64_GLOB_DAT  6
+#define R_X86_64_JUMP_SLOT 7
+#define R_X86_64_RELATIVE  8
+#define R_X86_64_32        10
+
 typedef uint32_t Elf32_Addr;
 typedef uint16_t Elf32_Half;
 typedef uint32_t Elf32_Off;
@@ -96,5 +164,13 @@ typedef struct {
 	Elf32_Word p_align;
 } __attribute__((packed)) Elf32_Phdr;
 
+typedef struct {
+	Elf32_Sword d_tag;
+	union {
+		Elf32_Word d_val;
+		Elf32_Addr d_ptr;
+	} d_un;
+} __attribute__((packed)) Elf32_Dyn;
+
 #endif // STMDSP_ELF_HPP
 
@@ -12,12 +12,63 @@
 #include "elfload.hpp"
 #include "elf.h"
 
+#include "ch.h"
+
+#include "conversion.hpp"
+#include "error.hpp"
+#include "periph/fmac.hpp"
+#include "runstatus.hpp"
+
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 
+// Alignment of relocatable images placed after the running one.
+constexpr uintptr_t IMAGE_ALIGNMENT = 64;
+
 __attribute__((section(".convdata")))
 ELFManager::EntryFunc ELFManager::m_entry = nullptr;
-std::array<unsigned char, MAX_ELF_FILE_SIZE> ELFManager::m_file_buffer = {};
+__attribute__((section(".convdata")))
+ELFManager::Hooks ELFManager::m_hooks;
+unsigned int ELFManager::m_block_size = 0;
+unsigned int ELFManager::m_history_size = 0;
+ELFManager::Extents ELFManager::m_extents;
+ELFManager::EntryFunc ELFManager::m_pending_entry = nullptr;
+ELFManager::Hooks ELFManager::m_pending_hooks;
+unsigned int ELFManager::m_pending_block_size = 0;
+unsigned int ELFManager::m_pending_history_size = 0;
+ELFManager::Extents ELFManager::m_pending_extents;
+volatile bool ELFManager::m_pending = false;
+
+// The kept parts of the ELF being loaded (see MAX_ELF_HEAD_SIZE): the
+// head holds its first head_size bytes, and the tail tail_size bytes from
+// tail_offset.
+static std::array<unsigned char, MAX_ELF_HEAD_SIZE> head;
+static std::array<unsigned char, MAX_ELF_TAIL_SIZE> tail;
+static size_t head_size = 0;
+static size_t tail_offset = 0;
+static size_t tail_size = 0;
+
+// A relocatable algorithm's dynamic tables, found through its PT_DYNAMIC
+// segment where they were loaded (as offsets from its link address). Its
+// symbols and relocations are taken from these, so that its section headers
+// need not be kept.
+struct DynamicTables
+{
+    const Elf32_Sym *symbols = nullptr;
+    uint32_t symbol_count = 0;
+    const char *names = nullptr;
+    uint32_t names_size = 0;
+    uint32_t rel = 0;
+    uint32_t rel_size = 0;
+    uint32_t rela = 0;
+    uint32_t rela_size = 0;
+    uint32_t plt_rel = 0;
+    uint32_t plt_rel_size = 0;
+    bool plt_rela = false;
+};
+
+static DynamicTables dynamic;
 
 static const unsigned char elf_header[] = { '\177', 'E', 'L', 'F' };
 
@@ -27,58 +78,653 @@ ELFManager::EntryFunc ELFManager::loadedElf()
     return m_entry;
 }
 
-unsigned char *ELFManager::fileBuffer()
+__attribute__((section(".convcode")))
+const ELFManager::Hooks& ELFManager::hooks()
+{
+    return m_hooks;
+}
+
+unsigned int ELFManager::blockSize()
 {
-    return m_file_buffer.data();
+    return m_block_size;
 }
 
+unsigned int ELFManager::historySize()
+{
+    return m_history_size;
+}
+
+// The running algorithm's extents are kept, as the runner may still be in it.
+// Any FMAC filter it loaded is dropped, here and on switches.
 void ELFManager::unload()
 {
+    fmac::stop();
+    m_pending = false;
     m_entry = nullptr;
+    m_hooks = {};
+    m_block_size = 0;
+    m_history_size = 0;
+}
+
+void ELFManager::apply()
+{
+    if (m_pending) {
+        std::atomic_signal_fence(std::memory_order_acquire);
+        fmac::stop();
+        m_entry = m_pending_entry;
+        m_hooks = m_pending_hooks;
+        m_block_size = m_pending_block_size;
+        m_history_size = m_pending_history_size;
+        m_extents = m_pending_extents;
+        std::atomic_signal_fence(std::memory_order_release);
+        m_pending = false;
+    }
 }
 
 template<typename T>
-constexpr static auto ptr_from_offset(void *base, uint32_t offset)
+constexpr static auto ptr_from_offset(const void *base, uint32_t offset)
 {
-    return reinterpret_cast<T>(reinterpret_cast<uint8_t *>(base) + offset);
+    return reinterpret_cast<T>(reinterpret_cast<const uint8_t *>(base) + offset);
 }
 
-bool ELFManager::loadFromInternalBuffer()
+template<typename T>
+constexpr static auto func_from_symbol(const void *symbol)
 {
-    m_entry = nullptr;
+    return reinterpret_cast<T>(reinterpret_cast<uintptr_t>(symbol));
+}
 
-    auto elf_data = m_file_buffer.data();
+// Returns the region of algorithm memory that holds the given range, or -1.
+static int algorithmRegion(uintptr_t addr, size_t size)
+{
+    for (unsigned int i = 0; i < ALGORITHM_REGIONS.size(); i++) {
+        const auto [begin, length] = ALGORITHM_REGIONS[i];
+        if (addr - begin <= length && size <= length - (addr - begin))
+            return i;
+    }
 
-    // Check the ELF's header signature
-    auto ehdr = reinterpret_cast<Elf32_Ehdr *>(elf_data);
-    if (!std::equal(ehdr->e_ident, ehdr->e_ident + 4, elf_header))
+    return -1;
+}
+
+static bool isAlgorithmMemory(uintptr_t addr, size_t size)
+{
+    return algorithmRegion(addr, size) >= 0;
+}
+
+// Pulls an ELF through a ReadFunc, keeping track of where in it we are.
+// Whatever is left is consumed when the stream goes, so that the command
+// stream stays in sync when a load fails.
+class Stream
+{
+public:
+    Stream(size_t size, ELFManager::ReadFunc read):
+        m_size(size), m_read(read) {}
+
+    ~Stream() {
+        skipTo(m_size);
+    }
+
+    size_t offset() const {
+        return m_offset;
+    }
+
+    bool read(void *dst, size_t count) {
+        if (count > m_size - m_offset)
+            return false;
+
+        auto n = m_read(static_cast<unsigned char *>(dst), count);
+        m_offset += n;
+        if (n != count) {
+            // The input ran short; there is nothing left to consume.
+            m_size = m_offset;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool skipTo(size_t offset) {
+        if (offset < m_offset || offset > m_size)
+            return false;
+
+        unsigned char chunk[64];
+        while (m_offset < offset) {
+            if (!read(chunk, std::min(sizeof(chunk), offset - m_offset)))
+                return false;
+        }
+
+        return true;
+    }
+
+private:
+    size_t m_size;
+    size_t m_offset = 0;
+    ELFManager::ReadFunc m_read;
+};
+
+static const Elf32_Ehdr *elfHeader()
+{
+    return reinterpret_cast<const Elf32_Ehdr *>(head.data());
+}
+
+// Returns the ELF's bytes at offset, if they were kept.
+static const void *fileData(uint32_t offset, uint32_t size)
+{
+    if (offset <= head_size && size <= head_size - offset)
+        return head.data() + offset;
+    if (offset >= tail_offset && offset - tail_offset <= tail_size &&
+        size <= tail_size - (offset - tail_offset))
+    {
+        return tail.data() + (offset - tail_offset);
+    }
+
+    return nullptr;
+}
+
+static const Elf32_Shdr *sectionHeader(unsigned int index)
+{
+    auto ehdr = elfHeader();
+    if (index >= ehdr->e_shnum || ehdr->e_shentsize < sizeof(Elf32_Shdr))
+        return nullptr;
+
+    return static_cast<const Elf32_Shdr *>(
+        fileData(ehdr->e_shoff + index * ehdr->e_shentsize, sizeof(Elf32_Shdr)));
+}
+
+// Returns the loaded bytes at the given link address, if they are in
+// algorithm memory.
+static const void *loadedData(uintptr_t base, uint32_t addr, uint32_t size)
+{
+    const auto loaded = base + addr;
+    return isAlgorithmMemory(loaded, size) ? reinterpret_cast<const void *>(loaded) : nullptr;
+}
+
+// Returns a section's contents: loaded sections are read where they were
+// loaded to, and others from the kept bytes.
+static const void *sectionData(const Elf32_Shdr *shdr, uintptr_t base)
+{
+    if (shdr->sh_flags & SHF_ALLOC)
+        return loadedData(base, shdr->sh_addr, shdr->sh_size);
+
+    return fileData(shdr->sh_offset, shdr->sh_size);
+}
+
+// Checks that the section headers, and the symbol tables with their names,
+// were kept, so that no symbol (e.g. block_size) is missed.
+static bool sectionsKept(uintptr_t base)
+{
+    for (Elf32_Half i = 0; i < elfHeader()->e_shnum; i++) {
+        auto shdr = sectionHeader(i);
+        if (shdr == nullptr)
+            return false;
+
+        if (shdr->sh_type == SHT_SYMTAB || shdr->sh_type == SHT_DYNSYM) {
+            auto strtab = sectionHeader(shdr->sh_link);
+            if (sectionData(shdr, base) == nullptr || strtab == nullptr ||
+                sectionData(strtab, base) == nullptr)
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Counts the dynamic symbols. DT_HASH holds the count; with DT_GNU_HASH, it
+// is one past the end of the chain of the last bucket that has symbols.
+static uint32_t dynamicSymbolCount(uintptr_t base, uint32_t hash, uint32_t gnu_hash)
+{
+    if (hash != 0) {
+        auto table = static_cast<const uint32_t *>(loadedData(base, hash, 2 * sizeof(uint32_t)));
+        return table != nullptr ? table[1] : 0;
+    } else if (gnu_hash == 0) {
+        return 0;
+    }
+
+    // {nbuckets, symoffset, bloom_size, bloom_shift}, the bloom filter, the
+    // buckets, then a chain word for each symbol from symoffset on.
+    auto header = static_cast<const uint32_t *>(loadedData(base, gnu_hash, 4 * sizeof(uint32_t)));
+    if (header == nullptr || header[0] > ALGORITHM_SIZE || header[2] > ALGORITHM_SIZE)
+        return 0;
+
+    const auto bucket_count = header[0];
+    const auto offset = header[1];
+    const uint32_t buckets_addr = gnu_hash + (4 + header[2]) * sizeof(uint32_t);
+    auto buckets = static_cast<const uint32_t *>(
+        loadedData(base, buckets_addr, bucket_count * sizeof(uint32_t)));
+    if (buckets == nullptr)
+        return 0;
+
+    uint32_t last = *std::max_element(buckets, buckets + bucket_count);
+    if (last < offset)
+        return offset;
+
+    const uint32_t chain_addr = buckets_addr + bucket_count * sizeof(uint32_t);
+    for (;; last++) {
+        auto chain = static_cast<const uint32_t *>(
+            loadedData(base, chain_addr + (last - offset) * sizeof(uint32_t), sizeof(uint32_t)));
+        if (chain == nullptr)
+            return 0;
+        if (*chain & 1)
+            return last + 1;
+    }
+}
+
+// Reads a relocatable algorithm's dynamic section into dynamic.
+static bool readDynamic(uintptr_t base)
+{
+    dynamic = {};
+
+    auto ehdr = elfHeader();
+    const Elf32_Dyn *entries = nullptr;
+    size_t count = 0;
+    auto phdr = ptr_from_offset<const Elf32_Phdr *>(head.data(), ehdr->e_phoff);
+    for (Elf32_Half i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr->p_type == PT_DYNAMIC) {
+            entries = static_cast<const Elf32_Dyn *>(loadedData(base, phdr->p_vaddr, phdr->p_memsz));
+            count = phdr->p_memsz / sizeof(Elf32_Dyn);
+        }
+
+        phdr = ptr_from_offset<const Elf32_Phdr *>(phdr, ehdr->e_phentsize);
+    }
+
+    if (entries == nullptr)
         return false;
 
-    // Iterate through program header LOAD sections
+    uint32_t symbols = 0;
+    uint32_t names = 0;
+    uint32_t hash = 0;
+    uint32_t gnu_hash = 0;
+    for (size_t i = 0; i < count && entries[i].d_tag != DT_NULL; i++) {
+        const auto value = entries[i].d_un.d_val;
+        switch (entries[i].d_tag) {
+        case DT_SYMTAB:   symbols = value; break;
+        case DT_STRTAB:   names = value; break;
+        case DT_STRSZ:    dynamic.names_size = value; break;
+        case DT_HASH:     hash = value; break;
+        case DT_GNU_HASH: gnu_hash = value; break;
+        case DT_REL:      dynamic.rel = value; break;
+        case DT_RELSZ:    dynamic.rel_size = value; break;
+        case DT_RELA:     dynamic.rela = value; break;
+        case DT_RELASZ:   dynamic.rela_size = value; break;
+        case DT_JMPREL:   dynamic.plt_rel = value; break;
+        case DT_PLTRELSZ: dynamic.plt_rel_size = value; break;
+        case DT_PLTREL:   dynamic.plt_rela = value == DT_RELA; break;
+        default:          break;
+        }
+    }
+
+    dynamic.symbol_count = dynamicSymbolCount(base, hash, gnu_hash);
+    if (dynamic.symbol_count > ALGORITHM_SIZE / sizeof(Elf32_Sym))
+        return false;
+    dynamic.symbols = static_cast<const Elf32_Sym *>(
+        loadedData(base, symbols, dynamic.symbol_count * sizeof(Elf32_Sym)));
+    dynamic.names = static_cast<const char *>(loadedData(base, names, dynamic.names_size));
+    return dynamic.symbol_count > 0 && dynamic.symbols != nullptr && dynamic.names != nullptr;
+}
+
+// Returns a symbol's loaded address.
+static uint32_t symbolAddress(const Elf32_Sym& sym, uintptr_t base)
+{
+    return sym.st_shndx == SHN_ABS ? sym.st_value : base + sym.st_value;
+}
+
+static const unsigned char *memory_source = nullptr;
+
+static size_t readMemory(unsigned char *dst, size_t count)
+{
+    std::memcpy(dst, memory_source, count);
+    memory_source += count;
+    return count;
+}
+
+enum class Relocation
+{
+    None,
+    Relative,   // base + A
+    Absolute,   // S + A
+    Symbol,     // S (GOT entries, whatever the linker left in them)
+    PcRelative, // S + A - P
+    Unsupported
+};
+
+// Sorts out the relocation types that position-independent algorithms need
+// (the simulator's host algorithms have their own).
+static Relocation relocationKind(Elf32_Half machine, uint32_t type)
+{
+    if (machine == EM_ARM) {
+        switch (type) {
+        case R_ARM_NONE:      return Relocation::None;
+        case R_ARM_RELATIVE:  return Relocation::Relative;
+        case R_ARM_ABS32:     return Relocation::Absolute;
+        case R_ARM_GLOB_DAT:
+        case R_ARM_JUMP_SLOT: return Relocation::Symbol;
+        case R_ARM_REL32:     return Relocation::PcRelative;
+        default:              break;
+        }
+#if defined(TARGET_PLATFORM_SIM)
+    } else if (machine == EM_386) {
+        switch (type) {
+        case R_386_NONE:     return Relocation::None;
+        case R_386_RELATIVE: return Relocation::Relative;
+        case R_386_32:       return Relocation::Absolute;
+        case R_386_GLOB_DAT:
+        case R_386_JMP_SLOT: return Relocation::Symbol;
+        case R_386_PC32:     return Relocation::PcRelative;
+        default:             break;
+        }
+    } else if (machine == EM_X86_64) {
+        switch (type) {
+        case R_X86_64_NONE:      return Relocation::None;
+        case R_X86_64_RELATIVE:  return Relocation::Relative;
+        case R_X86_64_32:        return Relocation::Absolute;
+        case R_X86_64_GLOB_DAT:
+        case R_X86_64_JUMP_SLOT: return Relocation::Symbol;
+        case R_X86_64_PC32:      return Relocation::PcRelative;
+        default:                 break;
+        }
+#endif
+    }
+
+    return Relocation::Unsupported;
+}
+
+// Applies a table of dynamic relocations, against the dynamic symbols.
+static bool relocateTable(uintptr_t base, uint32_t addr, uint32_t size, bool rela)
+{
+    if (size == 0)
+        return true;
+
+    auto rels = loadedData(base, addr, size);
+    if (rels == nullptr)
+        return false;
+
+    const uint32_t entsize = rela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+    for (uint32_t offset = 0; offset + entsize <= size; offset += entsize) {
+        // Elf32_Rela starts with an Elf32_Rel.
+        auto rel = ptr_from_offset<const Elf32_Rel *>(rels, offset);
+        auto kind = relocationKind(elfHeader()->e_machine, ELF32_R_TYPE(rel->r_info));
+        if (kind == Relocation::None)
+            continue;
+
+        const auto place = base + rel->r_offset;
+        if (kind == Relocation::Unsupported || !isAlgorithmMemory(place, sizeof(uint32_t)))
+            return false;
+
+        // Symbols must be defined by the algorithm itself.
+        uint32_t symbol = 0;
+        if (auto index = ELF32_R_SYM(rel->r_info); index != 0) {
+            if (index >= dynamic.symbol_count || dynamic.symbols[index].st_shndx == SHN_UNDEF)
+                return false;
+            symbol = symbolAddress(dynamic.symbols[index], base);
+        }
+
+        auto where = reinterpret_cast<uint32_t *>(place);
+        const uint32_t addend = rela ? reinterpret_cast<const Elf32_Rela *>(rel)->r_addend
+                                     : *where;
+        switch (kind) {
+        case Relocation::Relative:
+            *where = base + addend;
+            break;
+        case Relocation::Absolute:
+            *where = symbol + addend;
+            break;
+        case Relocation::Symbol:
+            // With REL, the GOT slot holds the linker's lazy-binding
+            // address (PLT0), not an addend.
+            *where = symbol;
+            break;
+        case Relocation::PcRelative:
+            *where = symbol + addend - place;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+// Applies the dynamic relocations (including the GOT's) of an algorithm
+// that was loaded at base rather than at its link address of zero.
+bool ELFManager::relocate(uintptr_t base)
+{
+    return relocateTable(base, dynamic.rel, dynamic.rel_size, false) &&
+           relocateTable(base, dynamic.rela, dynamic.rela_size, true) &&
+           relocateTable(base, dynamic.plt_rel, dynamic.plt_rel_size, dynamic.plt_rela);
+}
+
+// Finds a symbol of the given type and name in a symbol table.
+static const Elf32_Sym *findIn(const Elf32_Sym *sym, uint32_t count, const char *names,
+                               uint32_t names_size, const char *name, unsigned char type)
+{
+    for (uint32_t i = 0; i < count; i++, sym++) {
+        const auto bind = ELF32_ST_BIND(sym->st_info);
+        if (ELF32_ST_TYPE(sym->st_info) != type ||
+            (type == STT_FUNC && bind != STB_GLOBAL && bind != STB_WEAK))
+        {
+            continue;
+        }
+
+        if (sym->st_shndx != SHN_UNDEF && sym->st_name < names_size &&
+            std::strncmp(names + sym->st_name, name, names_size - sym->st_name) == 0)
+        {
+            return sym;
+        }
+    }
+
+    return nullptr;
+}
+
+// Finds a symbol's loaded address: through the dynamic symbols for
+// relocatable algorithms, and through the kept symbol table for others.
+const void *ELFManager::findSymbol(const char *name, uintptr_t base, unsigned char type)
+{
+    const Elf32_Sym *sym = nullptr;
+    if (elfHeader()->e_type == ET_DYN) {
+        sym = findIn(dynamic.symbols, dynamic.symbol_count, dynamic.names, dynamic.names_size,
+                     name, type);
+    } else {
+        for (Elf32_Half i = 0; sym == nullptr && i < elfHeader()->e_shnum; i++) {
+            auto shdr = sectionHeader(i);
+            if (shdr == nullptr || shdr->sh_type != SHT_SYMTAB)
+                continue;
+
+            auto strtab = sectionHeader(shdr->sh_link);
+            auto syms = static_cast<const Elf32_Sym *>(sectionData(shdr, base));
+            if (strtab == nullptr || syms == nullptr)
+                continue;
+
+            auto names = static_cast<const char *>(sectionData(strtab, base));
+            if (names != nullptr) {
+                sym = findIn(syms, shdr->sh_size / sizeof(Elf32_Sym), names, strtab->sh_size,
+                             name, type);
+            }
+        }
+    }
+
+    return sym != nullptr ? reinterpret_cast<const void *>(symbolAddress(*sym, base)) : nullptr;
+}
+
+bool ELFManager::load(const unsigned char *elf, size_t size)
+{
+    memory_source = elf;
+    return load(size, readMemory);
+}
+
+bool ELFManager::load(size_t size, ReadFunc read)
+{
+    Stream stream (size, read);
+
+    // While running, the algorithm in use (or about to be) must be left
+    // alone; otherwise, loading replaces it.
+    const bool running = run_status == RunStatus::Running;
+    if (running) {
+        while (m_pending && run_status == RunStatus::Running)
+            chThdSleepMicroseconds(100);
+    } else {
+        unload();
+    }
+
+    // The ELF header and program headers come first, and are kept.
+    head_size = 0;
+    tail_size = 0;
+    auto ehdr = elfHeader();
+    if (!stream.read(head.data(), sizeof(Elf32_Ehdr)))
+        return false;
+    if (!std::equal(ehdr->e_ident, ehdr->e_ident + 4, elf_header) ||
+        ehdr->e_phentsize != sizeof(Elf32_Phdr) || ehdr->e_phoff < sizeof(Elf32_Ehdr) ||
+        ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf32_Phdr) > head.size())
+    {
+        return false;
+    }
+
+    const size_t headers_end = ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf32_Phdr);
+    if (!stream.read(head.data() + sizeof(Elf32_Ehdr), headers_end - sizeof(Elf32_Ehdr)))
+        return false;
+    head_size = headers_end;
+
+    // Find the span of the LOAD sections in each region, as linked.
+    // Fixed-address algorithms go where they were linked, which is how they
+    // choose between the regions (e.g. ITCM for text, DTCM for data on the
+    // H7). Relocatable algorithms are linked for address zero, and are kept
+    // whole in the first region since their code reaches their data through
+    // PC-relative offsets.
+    const bool relocatable = ehdr->e_type == ET_DYN;
+    Extents linked;
+    auto phdr = ptr_from_offset<const Elf32_Phdr *>(head.data(), ehdr->e_phoff);
+    for (Elf32_Half i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr->p_type == PT_LOAD) {
+            auto region = relocatable ? 0 : algorithmRegion(phdr->p_vaddr, phdr->p_memsz);
+            if (region < 0)
+                return false;
+            linked[region].include(phdr->p_vaddr, phdr->p_vaddr + phdr->p_memsz);
+        }
+
+        phdr = ptr_from_offset<const Elf32_Phdr *>(phdr, ehdr->e_phentsize);
+    }
+
+    if (std::all_of(linked.cbegin(), linked.cend(), [](const auto& e) { return e.empty(); }))
+        return false;
+
+    // Relocatable algorithms are placed at the start of algorithm memory, or
+    // after the running algorithm if they would overlap it.
+    uintptr_t base = 0;
+    Extents extents = linked;
+    if (relocatable) {
+        base = ALGORITHM_ADDRESS;
+        if (running && linked[0].moved(base).overlaps(m_extents[0])) {
+            base = (m_extents[0].end - linked[0].begin + IMAGE_ALIGNMENT - 1) &
+                   ~(IMAGE_ALIGNMENT - 1);
+        }
+
+        extents[0] = linked[0].moved(base);
+    }
+
+    for (unsigned int i = 0; i < extents.size(); i++) {
+        const auto& extent = extents[i];
+        if (!extent.empty() &&
+            (algorithmRegion(extent.begin, extent.end - extent.begin) != static_cast<int>(i) ||
+             (running && extent.overlaps(m_extents[i]))))
+        {
+            return false;
+        }
+    }
+
+    // Load each segment as it arrives, and zero the rest of its memory (its
+    // bss). The start of the first segment may have come with the headers.
     bool loaded = false;
-    auto phdr = ptr_from_offset<Elf32_Phdr *>(elf_data, ehdr->e_phoff);
+    phdr = ptr_from_offset<const Elf32_Phdr *>(head.data(), ehdr->e_phoff);
     for (Elf32_Half i = 0; i < ehdr->e_phnum; i++) {
         if (phdr->p_type == PT_LOAD) {
-            if (phdr->p_filesz == 0) {
-                std::memset(reinterpret_cast<void *>(phdr->p_vaddr),
-                            0,
-                            phdr->p_memsz);
-            } else {
-                std::memcpy(reinterpret_cast<void *>(phdr->p_vaddr),
-                            ptr_from_offset<void *>(elf_data, phdr->p_offset),
-                            phdr->p_filesz);
-                if (!loaded)
-                    loaded = true;
+            if (phdr->p_filesz > phdr->p_memsz || phdr->p_offset > size ||
+                phdr->p_filesz > size - phdr->p_offset)
+            {
+                return false;
             }
+
+            auto dest = reinterpret_cast<unsigned char *>(base + phdr->p_vaddr);
+            size_t offset = phdr->p_offset;
+            size_t count = phdr->p_filesz;
+            if (offset < head_size) {
+                const auto kept = std::min(count, head_size - offset);
+                std::memcpy(dest, head.data() + offset, kept);
+                dest += kept;
+                offset += kept;
+                count -= kept;
+            }
+
+            if (count > 0 && (!stream.skipTo(offset) || !stream.read(dest, count)))
+                return false;
+
+            std::memset(reinterpret_cast<void *>(base + phdr->p_vaddr + phdr->p_filesz),
+                        0,
+                        phdr->p_memsz - phdr->p_filesz);
+            if (phdr->p_filesz > 0)
+                loaded = true;
         }
 
-        phdr = ptr_from_offset<Elf32_Phdr *>(phdr, ehdr->e_phentsize);
+        phdr = ptr_from_offset<const Elf32_Phdr *>(phdr, ehdr->e_phentsize);
     }
 
+    if (!loaded)
+        return false;
+
+    if (relocatable) {
+        // Symbols and relocations come from the dynamic section, which was
+        // loaded with the rest, so the section headers are not needed.
+        if (!readDynamic(base) || !relocate(base))
+            return false;
+    } else {
+        // Keep the end of the file, for the section headers and symbol tables.
+        tail_offset = std::max(stream.offset(), size - std::min(size, tail.size()));
+        if (!stream.skipTo(tail_offset) || !stream.read(tail.data(), size - tail_offset))
+            return false;
+        tail_size = size - tail_offset;
 
-    if (loaded)
-        m_entry = reinterpret_cast<ELFManager::EntryFunc>(ehdr->e_entry);
+        if (!sectionsKept(base)) {
+            EM.add(Error::BadUserCodeSymbols);
+            return false;
+        }
+    }
+
+    auto entry = func_from_symbol<EntryFunc>(findSymbol("process", base, STT_FUNC));
+    if (entry == nullptr)
+        entry = reinterpret_cast<EntryFunc>(base + ehdr->e_entry);
+    const Hooks hooks {
+        func_from_symbol<InitFunc>(findSymbol("init", base, STT_FUNC)),
+        func_from_symbol<ParamFunc>(findSymbol("on_param", base, STT_FUNC)),
+        func_from_symbol<StopFunc>(findSymbol("stop", base, STT_FUNC))
+    };
+    unsigned int block_size = 0;
+    unsigned int history_size = 0;
+    if (auto symbol = findSymbol("block_size", base, STT_OBJECT); symbol != nullptr)
+        block_size = *reinterpret_cast<const unsigned int *>(symbol);
+    if (auto symbol = findSymbol("history_size", base, STT_OBJECT); symbol != nullptr)
+        history_size = *reinterpret_cast<const unsigned int *>(symbol);
+
+    if (running) {
+        // The running algorithm may have been unloaded, so the sizes are
+        // checked against what the conversion was set up for.
+        if (!ConversionManager::canSwitchTo(block_size, history_size))
+            return false;
+
+        m_pending_entry = entry;
+        m_pending_hooks = hooks;
+        m_pending_block_size = block_size;
+        m_pending_history_size = history_size;
+        m_pending_extents = extents;
+        // The runner only reads the above once this is set.
+        std::atomic_signal_fence(std::memory_order_release);
+        m_pending = true;
+    } else {
+        m_entry = entry;
+        m_hooks = hooks;
+        m_extents = extents;
+        m_block_size = block_size;
+        m_history_size = history_size;
+    }
 
-    return loaded;
+    return true;
 }
 
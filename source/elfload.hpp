@@ -14,25 +14,157 @@
 
 #include "samplebuffer.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
+#include <cstdint>
+#include <utility>
 
 constexpr unsigned int MAX_ELF_FILE_SIZE = 16 * 1024;
+// The loader only keeps an ELF's first and last bytes: its ELF and program
+// headers, and the section headers, symbol table and string tables that
+// linkers put at the end. The rest is loaded straight to its place as it
+// arrives, or skipped. Fixed-address ELFs whose section headers and symbol
+// tables do not fit in the last MAX_ELF_TAIL_SIZE bytes are refused with
+// Error::BadUserCodeSymbols (strip their debug info to fit). Relocatable
+// ELFs are resolved through their loaded dynamic section instead, and have
+// no such limit.
+constexpr unsigned int MAX_ELF_HEAD_SIZE = 512;
+constexpr unsigned int MAX_ELF_TAIL_SIZE = 4 * 1024;
+
+// Memory that algorithms are loaded into (which the MPU gives them access
+// to): the ITCM on the H7, and SRAM2 on the L4. Algorithms are either linked
+// to run from here, or relocatable (linked with -fPIC -shared, or with -pie
+// and --export-dynamic, so that their dynamic section names their symbols).
+// While one runs, the next is loaded into whatever part of this memory the
+// running one does not use, so images should stay under half of it.
+#if defined(TARGET_PLATFORM_H7)
+constexpr uintptr_t ALGORITHM_ADDRESS = 0x00000000;
+constexpr size_t ALGORITHM_SIZE = 64 * 1024;
+// The H7 also has DTCM set aside for algorithm data. Fixed-address
+// algorithms may link their data and bss segments here, and their text to
+// the ITCM, so that neither shares a bus with the other.
+constexpr uintptr_t ALGORITHM_DATA_ADDRESS = 0x20018000;
+constexpr size_t ALGORITHM_DATA_SIZE = 32 * 1024;
+constexpr unsigned int ALGORITHM_REGION_COUNT = 2;
+#else
+constexpr uintptr_t ALGORITHM_ADDRESS = 0x10000000;
+constexpr size_t ALGORITHM_SIZE = 32 * 1024;
+constexpr unsigned int ALGORITHM_REGION_COUNT = 1;
+#endif
+
+// The above as {address, size} pairs, in region order.
+constexpr std::array<std::pair<uintptr_t, size_t>, ALGORITHM_REGION_COUNT> ALGORITHM_REGIONS {{
+    {ALGORITHM_ADDRESS, ALGORITHM_SIZE},
+#if defined(TARGET_PLATFORM_H7)
+    {ALGORITHM_DATA_ADDRESS, ALGORITHM_DATA_SIZE},
+#endif
+}};
 
 class ELFManager
 {
 public:
     using EntryFunc = Sample *(*)(Sample *, size_t);
-    
-    static bool loadFromInternalBuffer();
+    using InPlaceEntryFunc = void (*)(const Sample *, Sample *, size_t);
+    using FloatEntryFunc = float *(*)(float *, size_t);
+    using Q15EntryFunc = int16_t *(*)(int16_t *, size_t);
+    using ReadFunc = size_t (*)(unsigned char *, size_t);
+    using InitFunc = void (*)(unsigned int, unsigned int);
+    using ParamFunc = void (*)(unsigned int, uint32_t);
+    using StopFunc = void (*)();
+
+    // Optional entry points that an algorithm defines by name, called by the
+    // runner like process():
+    // void init(unsigned int sample_rate, unsigned int block_size) before
+    // its first block, for setup that should stay out of the blocks;
+    // void on_param(unsigned int id, uint32_t value) before the block after
+    // a parameter changes (see Parameters);
+    // void stop() once conversion stops, or another algorithm takes over.
+    struct Hooks
+    {
+        InitFunc init = nullptr;
+        ParamFunc on_param = nullptr;
+        StopFunc stop = nullptr;
+    };
+
+    // Loads an ELF of size bytes, pulling it through read as it is parsed.
+    // All size bytes are consumed, even on failure. Load segments must be in
+    // file order, as linkers emit them.
+    // While a conversion is running, the algorithm is loaded beside the
+    // running one and takes over from it at the next block (see apply()); it
+    // must then ask for the same block and history sizes, and a
+    // fixed-address algorithm must not overlap it.
+    static bool load(size_t size, ReadFunc read);
+    // Loads an ELF that is already in memory (e.g. in the algorithm store).
+    static bool load(const unsigned char *elf, size_t size);
+    // Internal only: Switches to the algorithm loaded during a conversion,
+    // if any. Called by the runner's wait, between blocks.
+    static void apply();
+    // The algorithm's "process" function, or its ELF entry point if it has
+    // no such symbol.
     static EntryFunc loadedElf();
-    static unsigned char *fileBuffer();
+    static const Hooks& hooks();
+    // Block size the algorithm asked to be called with, through a
+    // "block_size" symbol (an unsigned int), or zero if it did not.
+    static unsigned int blockSize();
+    // Number of past input samples the algorithm reads in front of each
+    // block, through a "history_size" symbol (an unsigned int), or zero.
+    // Such algorithms must leave their input unmodified.
+    static unsigned int historySize();
     static void unload();
 
 private:
+    // The part of a region of algorithm memory an image's segments occupy.
+    struct Extent
+    {
+        uintptr_t begin = 0;
+        uintptr_t end = 0;
+
+        bool empty() const {
+            return begin == end;
+        }
+
+        bool overlaps(const Extent& other) const {
+            return begin < other.end && other.begin < end;
+        }
+
+        Extent moved(uintptr_t offset) const {
+            return { begin + offset, end + offset };
+        }
+
+        void include(uintptr_t b, uintptr_t e) {
+            if (b == e) {
+                return;
+            } else if (empty()) {
+                begin = b;
+                end = e;
+            } else {
+                begin = std::min(begin, b);
+                end = std::max(end, e);
+            }
+        }
+    };
+
+    using Extents = std::array<Extent, ALGORITHM_REGION_COUNT>;
+
     static EntryFunc m_entry;
+    static Hooks m_hooks;
+    static unsigned int m_block_size;
+    static unsigned int m_history_size;
+    static Extents m_extents;
+
+    // A load waiting for the runner to switch to it.
+    static EntryFunc m_pending_entry;
+    static Hooks m_pending_hooks;
+    static unsigned int m_pending_block_size;
+    static unsigned int m_pending_history_size;
+    static Extents m_pending_extents;
+    static volatile bool m_pending;
 
-    static std::array<unsigned char, MAX_ELF_FILE_SIZE> m_file_buffer;
+    // Finds a symbol of the given type (STT_*); functions must be global or
+    // weak, so that static helpers are not taken for entry points.
+    static const void *findSymbol(const char *name, uintptr_t base, unsigned char type);
+    static bool relocate(uintptr_t base);
 };
 
 #endif // ELF_LOAD_HPP_
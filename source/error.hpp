@@ -23,7 +23,10 @@ enum class Error : char
     BadUserCodeSize,
     NotIdle,
     ConversionAborted,
-    NotRunning
+    NotRunning,
+    // A fixed-address ELF's section headers and symbol tables did not fit in
+    // its last MAX_ELF_TAIL_SIZE bytes (reported along with BadUserCodeLoad).
+    BadUserCodeSymbols
 };
 
 class ErrorManager
@@ -0,0 +1,224 @@
+/**
+ * @file fft.cpp
+ * @brief Real FFT and inverse FFT that algorithms may call directly.
+ *
+ * A real transform of N samples is done as a complex transform of N/2 points
+ * (radix-4 passes, plus one radix-2 pass when log2(N/2) is odd) followed by a
+ * split step. Like the Q15 kernels these run unprivileged, so the code and
+ * the twiddle table both live in .convcode; the table is a quarter-wave sine
+ * table built at compile time for MAX_FFT_SIZE, which smaller power-of-two
+ * sizes index with a stride. Single-precision throughout, for FPv4 on the L4
+ * and FPv5 on the H7.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "fft.hpp"
+
+// The firmware is built at -O0; the transforms are optimized on their own.
+// Loop distribution is disabled as it may introduce memcpy/memset calls,
+// which are not reachable from the algorithm's context.
+#define FFT_FUNCTION \
+    __attribute__((section(".convcode"), optimize("O2", "no-tree-loop-distribute-patterns")))
+
+constexpr unsigned int QUARTER = MAX_FFT_SIZE / 4;
+
+struct SineTable
+{
+    float values[QUARTER + 1];
+};
+
+// sin(2 * pi * i / MAX_FFT_SIZE) for the first quarter wave.
+static constexpr SineTable makeSineTable()
+{
+    SineTable table {};
+    for (unsigned int i = 0; i <= QUARTER; i++) {
+        table.values[i] = static_cast<float>(
+            __builtin_sin(3.14159265358979323846 * i / (MAX_FFT_SIZE / 2)));
+    }
+    return table;
+}
+
+// Kept out of .convcode itself, as GCC will not mix code and data in one
+// section; the linker scripts place .convcode.* in flashc as well.
+__attribute__((section(".convcode.tables"), used))
+static constexpr SineTable sines = makeSineTable();
+
+struct Complex
+{
+    float re, im;
+};
+
+__attribute__((always_inline))
+static inline Complex operator*(Complex a, Complex b)
+{
+    return { a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re };
+}
+
+__attribute__((always_inline))
+static inline Complex operator+(Complex a, Complex b)
+{
+    return { a.re + b.re, a.im + b.im };
+}
+
+__attribute__((always_inline))
+static inline Complex operator-(Complex a, Complex b)
+{
+    return { a.re - b.re, a.im - b.im };
+}
+
+__attribute__((always_inline))
+static inline Complex load(const float *data, unsigned int index)
+{
+    return { data[index * 2], data[index * 2 + 1] };
+}
+
+__attribute__((always_inline))
+static inline void store(float *data, unsigned int index, Complex value)
+{
+    data[index * 2] = value.re;
+    data[index * 2 + 1] = value.im;
+}
+
+// exp(sign * 2 * pi * i * index / MAX_FFT_SIZE), for index < MAX_FFT_SIZE / 2.
+__attribute__((always_inline))
+static inline Complex twiddle(unsigned int index, float sign)
+{
+    if (index <= QUARTER) {
+        return { sines.values[QUARTER - index], sign * sines.values[index] };
+    } else {
+        return { -sines.values[index - QUARTER],
+                 sign * sines.values[MAX_FFT_SIZE / 2 - index] };
+    }
+}
+
+__attribute__((always_inline))
+static inline bool isSupported(unsigned int size)
+{
+    return size >= 4 && size <= MAX_FFT_SIZE && (size & (size - 1)) == 0;
+}
+
+// In-place complex FFT of count points; sign is -1 forward, +1 inverse.
+FFT_FUNCTION
+static void transform(float *data, unsigned int count, float sign)
+{
+    for (unsigned int i = 0, j = 0; i < count; i++) {
+        if (i < j) {
+            auto t = load(data, i);
+            store(data, i, load(data, j));
+            store(data, j, t);
+        }
+
+        auto bit = count >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+    }
+
+    unsigned int half = 1;
+    if (__builtin_ctz(count) & 1) {
+        for (unsigned int i = 0; i < count; i += 2) {
+            auto a = load(data, i);
+            auto b = load(data, i + 1);
+            store(data, i, a + b);
+            store(data, i + 1, a - b);
+        }
+        half = 2;
+    }
+
+    // Two radix-2 passes (spans half and 2 * half) fused into one radix-4 pass.
+    for (; half < count; half *= 4) {
+        const auto stride = MAX_FFT_SIZE / (half * 4);
+        for (unsigned int k = 0; k < half; k++) {
+            const auto w2 = twiddle(k * stride, sign);
+            const auto w1 = twiddle(k * stride * 2, sign);
+
+            for (unsigned int i = k; i < count; i += half * 4) {
+                auto x0 = load(data, i);
+                auto x1 = load(data, i + half) * w1;
+                auto x2 = load(data, i + half * 2);
+                auto x3 = load(data, i + half * 3) * w1;
+
+                auto y0 = x0 + x1;
+                auto y1 = x0 - x1;
+                auto y2 = (x2 + x3) * w2;
+                auto y3 = (x2 - x3) * w2;
+                y3 = { -sign * y3.im, sign * y3.re };
+
+                store(data, i, y0 + y2);
+                store(data, i + half, y1 + y3);
+                store(data, i + half * 2, y0 - y2);
+                store(data, i + half * 3, y1 - y3);
+            }
+        }
+    }
+}
+
+namespace fft {
+
+FFT_FUNCTION
+bool real(float *data, unsigned int size)
+{
+    if (!isSupported(size))
+        return false;
+
+    const auto count = size / 2;
+    const auto stride = MAX_FFT_SIZE / size;
+    transform(data, count, -1.f);
+
+    // Separate the spectra of the even and odd samples, then combine them.
+    const auto z0 = load(data, 0);
+    data[0] = z0.re + z0.im;
+    data[1] = z0.re - z0.im;
+
+    for (unsigned int k = 1; k <= count / 2; k++) {
+        const auto zk = load(data, k);
+        const auto zm = load(data, count - k);
+        const Complex even { (zk.re + zm.re) * 0.5f, (zk.im - zm.im) * 0.5f };
+        const Complex odd { (zk.im + zm.im) * 0.5f, (zm.re - zk.re) * 0.5f };
+        const auto t = twiddle(k * stride, -1.f) * odd;
+
+        store(data, k, even + t);
+        store(data, count - k, { even.re - t.re, t.im - even.im });
+    }
+
+    return true;
+}
+
+FFT_FUNCTION
+bool realInverse(float *data, unsigned int size)
+{
+    if (!isSupported(size))
+        return false;
+
+    const auto count = size / 2;
+    const auto stride = MAX_FFT_SIZE / size;
+    const auto scale = 1.f / size;
+
+    // Rebuild the spectrum of the interleaved samples, scaled by 1/count.
+    const auto dc = data[0];
+    const auto nyquist = data[1];
+    data[0] = (dc + nyquist) * scale;
+    data[1] = (dc - nyquist) * scale;
+
+    for (unsigned int k = 1; k <= count / 2; k++) {
+        const auto xk = load(data, k);
+        const auto xm = load(data, count - k);
+        const Complex even { (xk.re + xm.re) * scale, (xk.im - xm.im) * scale };
+        const Complex diff { (xk.re - xm.re) * scale, (xk.im + xm.im) * scale };
+        const auto odd = twiddle(k * stride, 1.f) * diff;
+
+        store(data, k, { even.re - odd.im, even.im + odd.re });
+        store(data, count - k, { even.re + odd.im, odd.re - even.im });
+    }
+
+    transform(data, count, 1.f);
+    return true;
+}
+
+} // namespace fft
+
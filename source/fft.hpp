@@ -0,0 +1,34 @@
+/**
+ * @file fft.hpp
+ * @brief Real FFT and inverse FFT that algorithms may call directly.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_FFT_HPP
+#define STMDSP_FFT_HPP
+
+#include "samplebuffer.hpp"
+
+// Largest transform: one slot of the largest sample buffer.
+constexpr unsigned int MAX_FFT_SIZE = MAX_SAMPLE_BUFFER_SIZE / 2;
+
+namespace fft
+{
+    // In-place FFT of size real samples, where size is a power of two from
+    // 4 to MAX_FFT_SIZE. The result is packed as {X[0], X[size/2], then the
+    // real and imaginary parts of X[1] to X[size/2 - 1]}, with no scaling.
+    // Returns false (leaving data untouched) for an unsupported size.
+    bool real(float *data, unsigned int size);
+
+    // Inverse of real(): takes the packed spectrum and returns the samples,
+    // scaled by 1/size so that the round trip is exact.
+    bool realInverse(float *data, unsigned int size);
+}
+
+#endif // STMDSP_FFT_HPP
+
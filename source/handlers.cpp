@@ -3,8 +3,37 @@
 #include "adc.hpp"
 #include "conversion.hpp"
 #include "cordic.hpp"
+#include "elfload.hpp"
+#include "fmac.hpp"
+#include "messagelog.hpp"
 #include "runstatus.hpp"
 
+#include <algorithm>
+#include <utility>
+
+// The unprivileged data region of the runner (its stack and buffers).
+#if defined(TARGET_PLATFORM_H7)
+constexpr std::pair<uint32_t, uint32_t> runner_data {0x20000000, 64 * 1024};
+#else
+constexpr std::pair<uint32_t, uint32_t> runner_data {0x20008000, 128 * 1024};
+#endif
+
+// Checks that an array given by the algorithm lies within memory that it
+// can access itself (see the MPU setup in the board files), so that syscalls
+// can't be used to reach anything else: the runner's data, or algorithm
+// memory (see elfload.hpp).
+static bool isAlgorithmMemory(uint32_t addr, uint32_t count, uint32_t elemsize)
+{
+    auto within = [=](const auto& region) {
+        const auto [base, length] = region;
+        return addr >= base && count <= length / elemsize &&
+               addr - base <= length - count * elemsize;
+    };
+
+    return within(runner_data) ||
+           std::any_of(ALGORITHM_REGIONS.cbegin(), ALGORITHM_REGIONS.cend(), within);
+}
+
 extern "C" {
 
 time_measurement_t conversion_time_measurement;
@@ -14,25 +43,38 @@ void port_syscall(struct port_extctx *ctxp, uint32_t n)
 {
     switch (n) {
 
-    // Sleeps the current thread until a message is received.
+    // Sleeps the current thread until the ADC has a slot ready for it.
     // Used the algorithm runner to wait for new data.
     case 0:
-        {
-            chSysLock();
-            chMsgWaitS();
-            auto monitor = ConversionManager::getMonitorHandle();
-            auto msg = chMsgGet(monitor);
-            chMsgReleaseS(monitor, MSG_OK);
-            chSysUnlock();
-            ctxp->r0 = msg;
-        }
+        ctxp->r0 = ConversionManager::waitForConversion();
         break;
 
     // Provides access to advanced math functions.
     // A service call like this is required for some hardware targets that
     // provide hardware-accelerated math computations (e.g. CORDIC).
+    // With cordic::VECTOR set, evaluates a whole array in one call (also
+    // available without the trap through the service table); with
+    // cordic::STREAM set, streams raw CORDIC calculations.
     case 1:
-        {
+        if (ctxp->r0 & cordic::STREAM) {
+            if (isAlgorithmMemory(ctxp->r1, ctxp->r3, sizeof(uint32_t)) &&
+                isAlgorithmMemory(ctxp->r2, ctxp->r3, sizeof(uint32_t)))
+            {
+                cordic::stream(ctxp->r0 & 0xFF, ctxp->r0 & cordic::Q15,
+                               reinterpret_cast<const uint32_t *>(ctxp->r1),
+                               reinterpret_cast<uint32_t *>(ctxp->r2),
+                               ctxp->r3);
+            }
+        } else if (ctxp->r0 & cordic::VECTOR) {
+            if (isAlgorithmMemory(ctxp->r1, ctxp->r3, sizeof(float)) &&
+                isAlgorithmMemory(ctxp->r2, ctxp->r3, sizeof(float)))
+            {
+                cordic::vector(ctxp->r0 & ~cordic::VECTOR,
+                               reinterpret_cast<const float *>(ctxp->r1),
+                               reinterpret_cast<float *>(ctxp->r2),
+                               ctxp->r3);
+            }
+        } else {
             using mathcall = void (*)();
             static mathcall funcs[3] = {
                 reinterpret_cast<mathcall>(cordic::sin),
@@ -76,21 +118,52 @@ void port_syscall(struct port_extctx *ctxp, uint32_t n)
         break;
 
     // Reads one of the analog inputs made available for algorithm run-time input.
+    // These are sampled in the background, so this only returns the latest.
     case 3:
         ctxp->r0 = ADC::readAlt(ctxp->r0);
         break;
 
-    //case 4:
-    //    {
-    //        const char *str = reinterpret_cast<const char *>(ctxp->r0);
-    //        auto src = str;
-    //        auto dst = userMessageBuffer;
-    //        while (*src)
-    //            *dst++ = *src++;
-    //        *dst = '\0';
-    //        userMessageSize = src - str;
-    //    }
-    //    break;
+    // Appends r1 bytes at r0 to the message log, for the host to read with
+    // the 'u' command. The service table's log_write does the same without
+    // the trap.
+    case 4:
+        ctxp->r0 = isAlgorithmMemory(ctxp->r0, ctxp->r1, sizeof(char)) &&
+                   MessageLog::write(reinterpret_cast<const char *>(ctxp->r0), ctxp->r1);
+        break;
+
+    // Runs filters on the H7's FMAC (see fmac.hpp).
+    case 5:
+        switch (static_cast<fmac::Call>(ctxp->r0)) {
+        case fmac::Call::LoadFir:
+            ctxp->r0 = isAlgorithmMemory(ctxp->r1, ctxp->r2, sizeof(int16_t)) &&
+                       fmac::loadFir(reinterpret_cast<const int16_t *>(ctxp->r1),
+                                     ctxp->r2, ctxp->r3);
+            break;
+        case fmac::Call::LoadIir:
+            ctxp->r0 = isAlgorithmMemory(ctxp->r1, (ctxp->r2 & 0xFF) + (ctxp->r2 >> 8 & 0xFF),
+                                         sizeof(int16_t)) &&
+                       fmac::loadIir(reinterpret_cast<const int16_t *>(ctxp->r1),
+                                     ctxp->r2 & 0xFF, ctxp->r2 >> 8 & 0xFF, ctxp->r3);
+            break;
+        case fmac::Call::Start:
+            ctxp->r0 = isAlgorithmMemory(ctxp->r1, ctxp->r3, sizeof(int16_t)) &&
+                       isAlgorithmMemory(ctxp->r2, ctxp->r3, sizeof(int16_t)) &&
+                       fmac::start(reinterpret_cast<const int16_t *>(ctxp->r1),
+                                   reinterpret_cast<int16_t *>(ctxp->r2), ctxp->r3);
+            break;
+        case fmac::Call::Wait:
+            ctxp->r0 = fmac::wait();
+            break;
+        case fmac::Call::Stop:
+            fmac::stop();
+            ctxp->r0 = true;
+            break;
+        default:
+            ctxp->r0 = false;
+            break;
+        }
+        break;
+
     default:
         while (1);
         break;
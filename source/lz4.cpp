@@ -0,0 +1,130 @@
+/**
+ * @file lz4.cpp
+ * @brief Streaming decompression of LZ4 blocks, for compressed uploads.
+ *
+ * A block is a series of sequences: a token (literal count in the high
+ * nibble, match length minus four in the low nibble, either extended by
+ * following bytes while they are 255), the literals, then a two-byte
+ * little-endian offset back into the output to copy the match from. The last
+ * sequence ends after its literals.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "lz4.hpp"
+
+#include <array>
+
+constexpr unsigned int MIN_MATCH = 4;
+
+// Reads the compressed block through a small buffer, stopping at its end.
+class Input
+{
+public:
+    Input(unsigned int size, lz4::ReadFunc read):
+        m_remaining(size), m_read(read) {}
+
+    bool get(unsigned char& byte) {
+        if (m_index == m_count) {
+            if (m_remaining == 0)
+                return false;
+
+            auto count = m_remaining < m_buffer.size() ? m_remaining : m_buffer.size();
+            m_count = m_read(m_buffer.data(), count);
+            m_index = 0;
+            if (m_count == 0) {
+                m_remaining = 0;
+                return false;
+            }
+
+            m_remaining -= m_count;
+        }
+
+        byte = m_buffer[m_index++];
+        return true;
+    }
+
+    // Extends a nibble's length with the following bytes while they are 255.
+    bool length(unsigned int& length) {
+        if (length == 15) {
+            unsigned char byte;
+            do {
+                if (!get(byte))
+                    return false;
+                length += byte;
+            } while (byte == 255);
+        }
+
+        return true;
+    }
+
+    bool empty() const {
+        return m_index == m_count && m_remaining == 0;
+    }
+
+    void drain() {
+        for (unsigned char byte; get(byte););
+    }
+
+private:
+    std::array<unsigned char, 64> m_buffer;
+    unsigned int m_index = 0;
+    unsigned int m_count = 0;
+    unsigned int m_remaining;
+    lz4::ReadFunc m_read;
+};
+
+static unsigned int decompressBlock(unsigned char *dst, unsigned int dstsize, Input& input)
+{
+    unsigned int written = 0;
+
+    for (unsigned char token; input.get(token);) {
+        unsigned int literals = token >> 4;
+        if (!input.length(literals) || literals > dstsize - written)
+            return 0;
+
+        for (; literals > 0; literals--) {
+            if (!input.get(dst[written++]))
+                return 0;
+        }
+
+        if (input.empty())
+            return written;
+
+        unsigned char offset[2];
+        if (!input.get(offset[0]) || !input.get(offset[1]))
+            return 0;
+
+        unsigned int distance = offset[0] | (offset[1] << 8);
+        unsigned int match = token & 0xF;
+        if (distance == 0 || distance > written || !input.length(match))
+            return 0;
+
+        // Matches may overlap the bytes they produce, so copy forwards.
+        match += MIN_MATCH;
+        if (match > dstsize - written)
+            return 0;
+        for (; match > 0; match--, written++)
+            dst[written] = dst[written - distance];
+    }
+
+    return 0;
+}
+
+namespace lz4 {
+
+unsigned int decompress(unsigned char *dst, unsigned int dstsize,
+                        unsigned int srcsize, ReadFunc read)
+{
+    Input input (srcsize, read);
+    auto size = decompressBlock(dst, dstsize, input);
+    input.drain();
+    return size;
+}
+
+} // namespace lz4
+
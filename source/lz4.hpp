@@ -0,0 +1,35 @@
+/**
+ * @file lz4.hpp
+ * @brief Streaming decompression of LZ4 blocks, for compressed uploads.
+ *
+ * Hosts can produce the blocks with the Python lz4 package (pip install lz4),
+ * through lz4.block.compress(piece, store_size=False) for each piece of the
+ * ELF (see loadCompressedAlgorithm() in communication.cpp).
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_LZ4_HPP
+#define STMDSP_LZ4_HPP
+
+#include <cstddef>
+
+namespace lz4
+{
+    using ReadFunc = size_t (*)(unsigned char *, size_t);
+
+    // Decompresses a raw LZ4 block (no frame) of srcsize bytes into dst,
+    // pulling the compressed data through read a small piece at a time.
+    // All srcsize bytes are consumed, even on failure. Returns the size of
+    // the decompressed data, or zero if the block is malformed, the input
+    // runs short, or the output would exceed dstsize.
+    unsigned int decompress(unsigned char *dst, unsigned int dstsize,
+                            unsigned int srcsize, ReadFunc read);
+}
+
+#endif // STMDSP_LZ4_HPP
+
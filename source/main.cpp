@@ -16,6 +16,7 @@
 #include "cordic.hpp"
 #include "dac.hpp"
 #include "error.hpp"
+#include "fmac.hpp"
 #include "sclock.hpp"
 #include "usbserial.hpp"
 
@@ -43,6 +44,7 @@ int main()
     SClock::begin();
     USBSerial::begin();
     cordic::init();
+    fmac::init();
 
     SClock::setRate(SClock::Rate::R32K);
     ADC::setRate(SClock::Rate::R32K);
@@ -0,0 +1,74 @@
+/**
+ * @file messagelog.cpp
+ * @brief Ring buffer of messages from the algorithm, drained by the host.
+ *
+ * Both sides run on the one core, so ordering the buffer writes before the
+ * index update only needs a compiler barrier.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "messagelog.hpp"
+
+#include "periph/usbserial.hpp"
+
+#include <atomic>
+
+__attribute__((section(".convdata")))
+volatile uint32_t MessageLog::m_head = 0;
+__attribute__((section(".convdata")))
+volatile uint32_t MessageLog::m_tail = 0;
+__attribute__((section(".convdata")))
+volatile uint32_t MessageLog::m_dropped = 0;
+uint32_t MessageLog::m_dropped_reported = 0;
+// A plain array, since std::array's accessors are not inlined at -O0.
+__attribute__((section(".convdata")))
+char MessageLog::m_buffer[MESSAGE_LOG_SIZE] = {};
+
+__attribute__((section(".convcode")))
+bool MessageLog::write(const char *data, unsigned int size)
+{
+    const uint32_t head = m_head;
+    if (size > MESSAGE_LOG_SIZE - (head - m_tail)) {
+        m_dropped = m_dropped + size;
+        return false;
+    }
+
+    for (unsigned int i = 0; i < size; i++)
+        m_buffer[(head + i) & (MESSAGE_LOG_SIZE - 1)] = data[i];
+
+    std::atomic_signal_fence(std::memory_order_release);
+    m_head = head + size;
+    return true;
+}
+
+void MessageLog::drain()
+{
+    const uint32_t head = m_head;
+    std::atomic_signal_fence(std::memory_order_acquire);
+    const uint32_t tail = m_tail;
+    const uint32_t dropped = m_dropped;
+
+    const uint32_t lost = dropped - m_dropped_reported;
+    const uint16_t count = head - tail;
+    USBSerial::write(reinterpret_cast<const uint8_t *>(&lost), sizeof(lost));
+    USBSerial::write(reinterpret_cast<const uint8_t *>(&count), sizeof(count));
+
+    // The ring's contents may wrap around its end.
+    const auto start = tail & (MESSAGE_LOG_SIZE - 1);
+    const auto first = count < MESSAGE_LOG_SIZE - start ? count : MESSAGE_LOG_SIZE - start;
+    if (first > 0)
+        USBSerial::write(reinterpret_cast<const uint8_t *>(m_buffer + start), first);
+    if (count > first)
+        USBSerial::write(reinterpret_cast<const uint8_t *>(m_buffer), count - first);
+
+    // Only now may the algorithm reuse the space.
+    std::atomic_signal_fence(std::memory_order_release);
+    m_tail = head;
+    m_dropped_reported = dropped;
+}
+
@@ -0,0 +1,51 @@
+/**
+ * @file messagelog.hpp
+ * @brief Ring buffer of messages from the algorithm, drained by the host.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_MESSAGELOG_HPP
+#define STMDSP_MESSAGELOG_HPP
+
+#include <cstdint>
+
+// Must be a power of two. Shares the unprivileged data region with the
+// runner's stack.
+constexpr unsigned int MESSAGE_LOG_SIZE =
+#if defined(TARGET_PLATFORM_H7)
+                                          1024;
+#else
+                                          512;
+#endif
+
+// A single-producer, single-consumer ring: the algorithm appends to it
+// without locking or trapping, and the host drains it with the 'u' command.
+class MessageLog
+{
+public:
+    // Appends size bytes (text, or binary records) as a whole. If there is
+    // no room, the message is dropped and counted instead. Runs unprivileged.
+    static bool write(const char *data, unsigned int size);
+
+    // Sends the logged bytes to the host, as the count of bytes dropped
+    // since the last drain (4 bytes), the count of bytes that follow
+    // (2 bytes), and then the bytes themselves.
+    static void drain();
+
+private:
+    // Free-running indices: m_head is only written by write(), and m_tail
+    // only by drain().
+    static volatile uint32_t m_head;
+    static volatile uint32_t m_tail;
+    static volatile uint32_t m_dropped;
+    static uint32_t m_dropped_reported;
+    static char m_buffer[MESSAGE_LOG_SIZE];
+};
+
+#endif // STMDSP_MESSAGELOG_HPP
+
@@ -0,0 +1,77 @@
+/**
+ * @file parameters.cpp
+ * @brief Parameter block that the host updates while algorithms run.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "parameters.hpp"
+
+#include "ch.h"
+
+#include "runstatus.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+__attribute__((section(".convdata")))
+std::array<uint32_t, PARAMETER_COUNT> Parameters::m_values = {};
+std::array<uint32_t, PARAMETER_COUNT> Parameters::m_shadow = {};
+std::array<uint32_t, Parameters::MARK_WORDS> Parameters::m_shadow_changed = {};
+volatile bool Parameters::m_pending = false;
+__attribute__((section(".convdata")))
+uint32_t Parameters::m_changed[Parameters::MARK_WORDS] = {};
+
+void Parameters::write(unsigned int offset, const uint32_t *values, unsigned int count)
+{
+    while (m_pending && run_status == RunStatus::Running)
+        chThdSleepMicroseconds(100);
+
+    std::copy(values, values + count, m_shadow.begin() + offset);
+
+    if (run_status == RunStatus::Running) {
+        for (auto i = offset; i < offset + count; i++)
+            m_shadow_changed[i / 32] |= 1u << (i % 32);
+
+        // The runner only reads the shadow once this is set.
+        std::atomic_signal_fence(std::memory_order_release);
+        m_pending = true;
+    } else {
+        m_values = m_shadow;
+        m_pending = false;
+    }
+}
+
+void Parameters::apply()
+{
+    if (m_pending) {
+        std::atomic_signal_fence(std::memory_order_acquire);
+        m_values = m_shadow;
+        for (unsigned int i = 0; i < MARK_WORDS; i++)
+            m_changed[i] |= m_shadow_changed[i];
+        m_shadow_changed = {};
+        std::atomic_signal_fence(std::memory_order_release);
+        m_pending = false;
+    }
+}
+
+__attribute__((section(".convcode")))
+void Parameters::notify(ChangeFunc func)
+{
+    // Indexed through a plain pointer, since std::array's accessors are not
+    // inlined at -O0 and would live outside of the runner's reach in .text.
+    auto values = reinterpret_cast<const uint32_t *>(&m_values);
+    for (unsigned int i = 0; i < PARAMETER_COUNT; i++) {
+        const uint32_t mark = 1u << (i % 32);
+        if (m_changed[i / 32] & mark) {
+            m_changed[i / 32] &= ~mark;
+            if (func != nullptr)
+                func(i, values[i]);
+        }
+    }
+}
+
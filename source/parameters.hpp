@@ -0,0 +1,51 @@
+/**
+ * @file parameters.hpp
+ * @brief Parameter block that the host updates while algorithms run.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_PARAMETERS_HPP
+#define STMDSP_PARAMETERS_HPP
+
+#include <array>
+#include <cstdint>
+
+// Each parameter is a word, holding a float or an integer as the host wrote it.
+constexpr unsigned int PARAMETER_COUNT = 64;
+
+class Parameters
+{
+public:
+    using ChangeFunc = void (*)(unsigned int, uint32_t);
+
+    // Writes count values from offset into the shadow copy. While running,
+    // this first waits for the runner to take the previous batch; the batch
+    // is then taken as a whole before the algorithm's next block.
+    static void write(unsigned int offset, const uint32_t *values, unsigned int count);
+    // Internal only: Takes the pending batch, if any, marking the values it
+    // wrote as changed. Called by the runner's wait, between blocks.
+    static void apply();
+    // Internal only: Passes each value changed since the last call to func
+    // (if not null) with its index, clearing the marks. Called by the runner.
+    static void notify(ChangeFunc func);
+
+    // The values that the algorithm sees (see the service table).
+    static std::array<uint32_t, PARAMETER_COUNT> m_values;
+
+private:
+    constexpr static unsigned int MARK_WORDS = (PARAMETER_COUNT + 31) / 32;
+
+    static std::array<uint32_t, PARAMETER_COUNT> m_shadow;
+    static std::array<uint32_t, MARK_WORDS> m_shadow_changed;
+    static volatile bool m_pending;
+    // One bit per value; a plain array, as the runner reads it.
+    static uint32_t m_changed[MARK_WORDS];
+};
+
+#endif // STMDSP_PARAMETERS_HPP
+
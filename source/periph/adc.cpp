@@ -16,7 +16,7 @@ ADCDriver *ADC::m_driver = &ADCD1;
 ADCDriver *ADC::m_driver2 = &ADCD3;
 #else
 ADCDriver *ADC::m_driver = &ADCD3;
-//ADCDriver *ADC::m_driver2 = &ADCD1; // TODO
+ADCDriver *ADC::m_driver2 = &ADCD1;
 #endif
 
 const ADCConfig ADC::m_config = {
@@ -62,40 +62,52 @@ ADCConversionGroup ADC::m_group_config = {
     },
 };
 
-static bool readAltDone = false;
-static void readAltCallback(ADCDriver *)
-{
-    readAltDone = true;
-}
+// The knobs are converted continuously in the background, each averaged over
+// 64 of the longest conversions by the ADC (around 100 updates per second).
+// Results are scaled to 12 bits on both targets.
 ADCConversionGroup ADC::m_group_config2 = {
-    .circular = false,
+    .circular = true,
     .num_channels = 2,
-    .end_cb = readAltCallback,
+    .end_cb = ADC::altCallback,
     .error_cb = nullptr,
-    .cfgr = ADC_CFGR_EXTEN_RISING | ADC_CFGR_EXTSEL_SRC(13),  /* TIM6_TRGO */
-    .cfgr2 = 0,//ADC_CFGR2_ROVSE | ADC_CFGR2_OVSR_1 | ADC_CFGR2_OVSS_0, // Oversampling 2x
+    .cfgr = ADC_CFGR_CONT,
 #if defined(TARGET_PLATFORM_H7)
+    .cfgr2 = ADC_CFGR2_ROVSE | (63 << ADC_CFGR2_OVSR_Pos) | (10 << ADC_CFGR2_OVSS_Pos),
     .ccr = 0,
-    .pcsel = 0,
+    .pcsel = ADC_SELMASK_IN10 | ADC_SELMASK_IN15,
     .ltr1 = 0, .htr1 = 4095,
     .ltr2 = 0, .htr2 = 4095,
     .ltr3 = 0, .htr3 = 4095,
+    .smpr = {
+        0, ADC_SMPR2_SMP_AN10(ADC_SMPR_SMP_640P5) | ADC_SMPR2_SMP_AN15(ADC_SMPR_SMP_640P5)
+    },
+    .sqr = {
+        ADC_SQR1_SQ1_N(ADC_CHANNEL_IN15) | ADC_SQR1_SQ2_N(ADC_CHANNEL_IN10),
+        0, 0, 0
+    },
 #else
+    .cfgr2 = ADC_CFGR2_ROVSE | (5 << ADC_CFGR2_OVSR_Pos) | (6 << ADC_CFGR2_OVSS_Pos),
     .tr1 = ADC_TR(0, 4095),
     .tr2 = ADC_TR(0, 4095),
     .tr3 = ADC_TR(0, 4095),
     .awd2cr = 0,
     .awd3cr = 0,
-#endif
     .smpr = {
-        ADC_SMPR1_SMP_AN1(ADC_SMPR_SMP_2P5) | ADC_SMPR1_SMP_AN2(ADC_SMPR_SMP_2P5), 0
+        ADC_SMPR1_SMP_AN1(ADC_SMPR_SMP_640P5) | ADC_SMPR1_SMP_AN2(ADC_SMPR_SMP_640P5), 0
     },
     .sqr = {
         ADC_SQR1_SQ1_N(ADC_CHANNEL_IN1) | ADC_SQR1_SQ2_N(ADC_CHANNEL_IN2),
         0, 0, 0
     },
+#endif
 };
 
+// The DMA can't reach the H7's DTCM, so results are copied over to the
+// algorithm's data from here.
+static std::array<adcsample_t, 2> altBuffer;
+__attribute__((section(".convdata")))
+std::array<adcsample_t, 2> ADC::m_alt_values = {{ 2048, 2048 }};
+
 adcsample_t *ADC::m_current_buffer = nullptr;
 size_t ADC::m_current_buffer_size = 0;
 ADC::Operation ADC::m_operation = nullptr;
@@ -104,6 +116,8 @@ void ADC::begin()
 {
 #if defined(TARGET_PLATFORM_H7)
     palSetPadMode(GPIOF, 3, PAL_MODE_INPUT_ANALOG);
+    palSetPadMode(GPIOA, 3, PAL_MODE_INPUT_ANALOG); // Potentiometer 1 (A0)
+    palSetPadMode(GPIOC, 0, PAL_MODE_INPUT_ANALOG); // Potentiometer 2 (A1)
 #else
     palSetPadMode(GPIOA, 0, PAL_MODE_INPUT_ANALOG); // Algorithm in
     palSetPadMode(GPIOC, 0, PAL_MODE_INPUT_ANALOG); // Potentiometer 1
@@ -112,6 +126,7 @@ void ADC::begin()
 
     adcStart(m_driver, &m_config);
     adcStart(m_driver2, &m_config2);
+    adcStartConversion(m_driver2, &m_group_config2, altBuffer.data(), 1);
 }
 
 void ADC::start(adcsample_t *buffer, size_t count, Operation operation)
@@ -136,15 +151,7 @@ void ADC::stop()
 
 adcsample_t ADC::readAlt(unsigned int id)
 {
-    if (id > 1)
-        return 0;
-    static adcsample_t result[16] = {};
-    readAltDone = false;
-    adcStartConversion(m_driver2, &m_group_config2, result, 8);
-    while (!readAltDone);
-        //__WFI();
-    adcStopConversion(m_driver2);
-    return result[id];
+    return id < m_alt_values.size() ? m_alt_values[id] : 0;
 }
 
 void ADC::setRate(SClock::Rate rate)
@@ -223,7 +230,6 @@ void ADC::setRate(SClock::Rate rate)
 
     // 8x oversample
     m_group_config.cfgr2 = ADC_CFGR2_ROVSE | (2 << ADC_CFGR2_OVSR_Pos) | (3 << ADC_CFGR2_OVSS_Pos);
-    m_group_config2.cfgr2 = ADC_CFGR2_ROVSE | (2 << ADC_CFGR2_OVSR_Pos) | (3 << ADC_CFGR2_OVSS_Pos);
 #endif
 }
 
@@ -232,6 +238,11 @@ void ADC::setOperation(ADC::Operation operation)
     m_operation = operation;
 }
 
+void ADC::altCallback(ADCDriver *)
+{
+    m_alt_values = altBuffer;
+}
+
 void ADC::conversionCallback(ADCDriver *driver)
 {
     if (m_operation != nullptr) {
@@ -46,7 +46,12 @@ private:
     static Operation m_operation;
 
 public:
+    // The latest knob readings, kept where the algorithm can read them
+    // (see the service table).
+    static std::array<adcsample_t, 2> m_alt_values;
+
     static void conversionCallback(ADCDriver *);
+    static void altCallback(ADCDriver *);
 };
 
 #endif // STMDSP_ADC_HPP_
@@ -1,12 +1,49 @@
 #ifndef CORDIC_HPP_
 #define CORDIC_HPP_
 
+#include <cstdint>
+
 namespace cordic {
     constexpr double PI = 3.1415926535L;
 
+    // Set in the function number given to the math syscall (svc 1) to
+    // evaluate an array of floats at once: r1 = input, r2 = output (may be
+    // the input), r3 = count.
+    constexpr unsigned int VECTOR = 0x100;
+    // Set instead to stream raw calculations of a Function: r1 = arguments,
+    // r2 = results, r3 = count (in words).
+    constexpr unsigned int STREAM = 0x200;
+    // With STREAM, selects the packed q1.15 format over q1.31.
+    constexpr unsigned int Q15 = 0x400;
+
+    // CORDIC functions, as numbered by its CSR.
+    enum Function : unsigned int {
+        Cosine = 0,
+        Sine,
+        Phase,
+        Modulus,
+        Arctangent,
+        HyperbolicCosine,
+        HyperbolicSine,
+        HyperbolicArctangent,
+        NaturalLog,
+        SquareRoot
+    };
+
     void init();
 
-#if !defined(TARGET_PLATFORM_L4)
+    // Evaluates sin (0), cos (1) or tan (2) over count values, in radians.
+    void vector(unsigned int func, const float *in, float *out, unsigned int count);
+
+    // Runs count calculations of func with the function configured once.
+    // In q1.31, each takes one argument word (with ARG2, e.g. the modulus,
+    // set to 1) and gives one result word. In q1.15, each takes one word
+    // packing ARG1 (low) and ARG2 (high), and gives one word packing RES1
+    // and RES2. L4 emulates the cosine and sine functions only.
+    void stream(unsigned int func, bool q15, const uint32_t *args, uint32_t *results,
+                unsigned int count);
+
+#if defined(TARGET_PLATFORM_H7)
     double mod(double n, double d);
 
     double cos(double x);
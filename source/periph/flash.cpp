@@ -0,0 +1,175 @@
+/**
+ * @file flash.cpp
+ * @brief Erases and programs the spare flash that algorithms are stored in.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flash.hpp"
+#include "hal.h"
+
+constexpr uintptr_t FLASH_ADDRESS = 0x08080000;
+
+// Unlock sequence of the control registers (not in the CMSIS headers).
+constexpr uint32_t FLASH_UNLOCK_KEY1 = 0x45670123;
+constexpr uint32_t FLASH_UNLOCK_KEY2 = 0xCDEF89AB;
+
+const unsigned char *Flash::data()
+{
+    return reinterpret_cast<const unsigned char *>(FLASH_ADDRESS);
+}
+
+#if defined(TARGET_PLATFORM_H7)
+// Every error flag of SR1, which CCR1 clears at the same positions.
+constexpr uint32_t FLASH_SR_ERRORS = 0x07EE0000;
+
+// The store is in sectors 4 to 7 of the single bank.
+constexpr unsigned int FIRST_SECTOR = 4;
+
+static void unlock()
+{
+    if (FLASH->CR1 & FLASH_CR_LOCK) {
+        FLASH->KEYR1 = FLASH_UNLOCK_KEY1;
+        FLASH->KEYR1 = FLASH_UNLOCK_KEY2;
+    }
+}
+
+static bool finish()
+{
+    while (FLASH->SR1 & (FLASH_SR_BSY | FLASH_SR_QW))
+        chThdSleepMicroseconds(100);
+
+    const bool ok = !(FLASH->SR1 & FLASH_SR_ERRORS);
+    FLASH->CCR1 = FLASH_SR_ERRORS | FLASH_SR_EOP;
+    return ok;
+}
+
+bool Flash::erase(size_t offset, size_t size)
+{
+    if (offset >= SIZE || size > SIZE - offset)
+        return false;
+
+    unlock();
+    FLASH->CCR1 = FLASH_SR_ERRORS | FLASH_SR_EOP;
+
+    bool ok = true;
+    for (auto sector = offset / ERASE_SIZE; ok && sector * ERASE_SIZE < offset + size; sector++) {
+        FLASH->CR1 = FLASH_CR_SER | FLASH_CR_PSIZE_1 |
+                     ((FIRST_SECTOR + sector) << FLASH_CR_SNB_Pos);
+        FLASH->CR1 |= FLASH_CR_START;
+        ok = finish();
+    }
+
+    FLASH->CR1 = FLASH_CR_LOCK;
+    cacheBufferInvalidate(data() + offset, size);
+    return ok;
+}
+
+bool Flash::write(size_t offset, const unsigned char *src, size_t size)
+{
+    if (offset % WRITE_SIZE != 0 || size % WRITE_SIZE != 0 ||
+        offset >= SIZE || size > SIZE - offset)
+    {
+        return false;
+    }
+
+    unlock();
+    FLASH->CCR1 = FLASH_SR_ERRORS | FLASH_SR_EOP;
+    FLASH->CR1 = FLASH_CR_PG | FLASH_CR_PSIZE_1;
+
+    // A flash word is programmed once all eight of its words are written.
+    bool ok = true;
+    auto dst = reinterpret_cast<volatile uint32_t *>(FLASH_ADDRESS + offset);
+    for (size_t i = 0; ok && i < size; i += WRITE_SIZE) {
+        for (size_t j = 0; j < WRITE_SIZE; j += sizeof(uint32_t)) {
+            *dst++ = src[i + j] | (src[i + j + 1] << 8) |
+                     (src[i + j + 2] << 16) | (src[i + j + 3] << 24);
+        }
+
+        __DSB();
+        ok = finish();
+    }
+
+    FLASH->CR1 = FLASH_CR_LOCK;
+    cacheBufferInvalidate(data() + offset, size);
+    return ok;
+}
+#else // L4
+// Every error flag of SR, which are cleared by writing them back.
+constexpr uint32_t FLASH_SR_ERRORS = 0x0000C3FA;
+
+static void unlock()
+{
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = FLASH_UNLOCK_KEY1;
+        FLASH->KEYR = FLASH_UNLOCK_KEY2;
+    }
+}
+
+static bool finish()
+{
+    while (FLASH->SR & FLASH_SR_BSY)
+        chThdSleepMicroseconds(100);
+
+    const bool ok = !(FLASH->SR & FLASH_SR_ERRORS);
+    FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+    return ok;
+}
+
+bool Flash::erase(size_t offset, size_t size)
+{
+    if (offset >= SIZE || size > SIZE - offset)
+        return false;
+
+    unlock();
+    FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+
+    bool ok = true;
+    for (auto page = offset / ERASE_SIZE; ok && page * ERASE_SIZE < offset + size; page++) {
+        FLASH->CR = FLASH_CR_PER | FLASH_CR_BKER | (page << FLASH_CR_PNB_Pos);
+        FLASH->CR |= FLASH_CR_STRT;
+        ok = finish();
+    }
+
+    FLASH->CR = FLASH_CR_LOCK;
+
+    // The data cache may still hold the erased contents.
+    FLASH->ACR &= ~FLASH_ACR_DCEN;
+    FLASH->ACR |= FLASH_ACR_DCRST;
+    FLASH->ACR &= ~FLASH_ACR_DCRST;
+    FLASH->ACR |= FLASH_ACR_DCEN;
+    return ok;
+}
+
+bool Flash::write(size_t offset, const unsigned char *src, size_t size)
+{
+    if (offset % WRITE_SIZE != 0 || size % WRITE_SIZE != 0 ||
+        offset >= SIZE || size > SIZE - offset)
+    {
+        return false;
+    }
+
+    unlock();
+    FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+    FLASH->CR = FLASH_CR_PG;
+
+    // Double words are programmed once their second word is written.
+    bool ok = true;
+    auto dst = reinterpret_cast<volatile uint32_t *>(FLASH_ADDRESS + offset);
+    for (size_t i = 0; ok && i < size; i += WRITE_SIZE) {
+        for (size_t j = 0; j < WRITE_SIZE; j += sizeof(uint32_t)) {
+            *dst++ = src[i + j] | (src[i + j + 1] << 8) |
+                     (src[i + j + 2] << 16) | (src[i + j + 3] << 24);
+        }
+
+        ok = finish();
+    }
+
+    FLASH->CR = FLASH_CR_LOCK;
+    return ok;
+}
+#endif
@@ -0,0 +1,48 @@
+/**
+ * @file flash.hpp
+ * @brief Erases and programs the spare flash that algorithms are stored in.
+ *
+ * The region is flash bank 2 on both targets, which the firmware does not
+ * use: on the H7 it is the second half of the single bank, on the L4 it is
+ * the second bank. Offsets are relative to the start of the region.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_FLASH_HPP_
+#define STMDSP_FLASH_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+class Flash
+{
+public:
+#if defined(TARGET_PLATFORM_H7)
+    constexpr static size_t SIZE = 512 * 1024;
+    constexpr static size_t ERASE_SIZE = 128 * 1024; // Sector
+    constexpr static size_t WRITE_SIZE = 32;         // Flash word
+#elif defined(TARGET_PLATFORM_SIM)
+    constexpr static size_t SIZE = 128 * 1024;
+    constexpr static size_t ERASE_SIZE = 2 * 1024;
+    constexpr static size_t WRITE_SIZE = 8;
+#else
+    constexpr static size_t SIZE = 512 * 1024;
+    constexpr static size_t ERASE_SIZE = 2 * 1024;   // Page
+    constexpr static size_t WRITE_SIZE = 8;          // Double word
+#endif
+
+    // The region, which reads like any other memory.
+    static const unsigned char *data();
+
+    // Erases every erase unit that the range touches, leaving it 0xFF.
+    static bool erase(size_t offset, size_t size);
+    // Programs erased flash. offset and size must be multiples of WRITE_SIZE.
+    static bool write(size_t offset, const unsigned char *data, size_t size);
+};
+
+#endif // STMDSP_FLASH_HPP_
@@ -0,0 +1,217 @@
+/**
+ * @file fmac.cpp
+ * @brief Runs FIR and IIR filters on the H7's filter math accelerator.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "fmac.hpp"
+#include "hal.h"
+
+#include <algorithm>
+#include <array>
+
+#if defined(TARGET_PLATFORM_H7)
+namespace fmac {
+
+// DMAMUX1 request lines of the FMAC (not in ChibiOS 20.3.2's list).
+constexpr uint32_t DMAMUX1_FMAC_READ = 121;
+constexpr uint32_t DMAMUX1_FMAC_WRITE = 122;
+
+// Extra room in the input and output buffers, so that the DMA can stay
+// ahead of the filter.
+constexpr unsigned int BUFFER_EXTRA = 4;
+
+// Limits of the P and Q parameters of each filter function.
+constexpr unsigned int FIR_MAX_TAPS = 127;
+constexpr unsigned int IIR_MAX_FEEDFORWARD = 64;
+
+// FMAC functions, as numbered by its PARAM register.
+constexpr uint32_t FUNC_LOAD_X1 = 1;
+constexpr uint32_t FUNC_LOAD_X2 = 2;
+constexpr uint32_t FUNC_LOAD_Y = 3;
+constexpr uint32_t FUNC_FIR = 8;
+constexpr uint32_t FUNC_IIR = 9;
+
+static const stm32_dma_stream_t *dma_write = nullptr;
+static const stm32_dma_stream_t *dma_read = nullptr;
+static bool loaded = false;
+static bool running = false;
+static int16_t *output = nullptr;
+static unsigned int output_count = 0;
+
+// DMA1 and DMA2 can't reach the TCMs that algorithms use, so blocks are
+// staged through AXI SRAM (which is not cached).
+static std::array<int16_t, MAX_BLOCK_SIZE> input_buffer;
+static std::array<int16_t, MAX_BLOCK_SIZE> output_buffer;
+
+void init()
+{
+    RCC->AHB2ENR |= RCC_AHB2ENR_FMACEN;
+
+    dma_write = dmaStreamAlloc(STM32_DMA_STREAM_ID_ANY, 3, nullptr, nullptr);
+    dma_read = dmaStreamAlloc(STM32_DMA_STREAM_ID_ANY, 3, nullptr, nullptr);
+    if (dma_write != nullptr && dma_read != nullptr) {
+        dmaSetRequestSource(dma_write, DMAMUX1_FMAC_WRITE);
+        dmaSetRequestSource(dma_read, DMAMUX1_FMAC_READ);
+        dmaStreamSetPeripheral(dma_write, &FMAC->WDATA);
+        dmaStreamSetPeripheral(dma_read, &FMAC->RDATA);
+    }
+}
+
+static bool load(const int16_t *coeffs, unsigned int feedforward,
+                 unsigned int feedback, unsigned int shift)
+{
+    stop();
+
+    // Coefficients go first, then room for the inputs and the outputs that
+    // the filter reaches back to.
+    const auto coeff_count = feedforward + feedback;
+    const auto x1_size = feedforward + BUFFER_EXTRA;
+    const auto y_size = (feedback > 0 ? feedback : 1) + BUFFER_EXTRA;
+
+    const bool valid = feedback > 0 ?
+        feedforward <= IIR_MAX_FEEDFORWARD && feedback < feedforward :
+        feedforward <= FIR_MAX_TAPS;
+    if (dma_write == nullptr || dma_read == nullptr || feedforward < 2 || !valid ||
+        coeff_count + x1_size + y_size > MEMORY_SIZE || shift > 7)
+    {
+        return false;
+    }
+    FMAC->X2BUFCFG = (0 << FMAC_X2BUFCFG_X2_BASE_Pos) |
+                     (coeff_count << FMAC_X2BUFCFG_X2_BUF_SIZE_Pos);
+    FMAC->X1BUFCFG = (coeff_count << FMAC_X1BUFCFG_X1_BASE_Pos) |
+                     (x1_size << FMAC_X1BUFCFG_X1_BUF_SIZE_Pos);
+    FMAC->YBUFCFG = ((coeff_count + x1_size) << FMAC_YBUFCFG_Y_BASE_Pos) |
+                    (y_size << FMAC_YBUFCFG_Y_BUF_SIZE_Pos);
+
+    FMAC->PARAM = (FUNC_LOAD_X2 << FMAC_PARAM_FUNC_Pos) |
+                  (feedforward << FMAC_PARAM_P_Pos) |
+                  (feedback << FMAC_PARAM_Q_Pos) | FMAC_PARAM_START;
+    for (unsigned int i = 0; i < coeff_count; i++)
+        FMAC->WDATA = static_cast<uint16_t>(coeffs[i]);
+
+    // Zero the history, so that the first input gives the first output.
+    if (feedforward > 1) {
+        FMAC->PARAM = (FUNC_LOAD_X1 << FMAC_PARAM_FUNC_Pos) |
+                      ((feedforward - 1) << FMAC_PARAM_P_Pos) | FMAC_PARAM_START;
+        for (unsigned int i = 0; i < feedforward - 1; i++)
+            FMAC->WDATA = 0;
+    }
+    if (feedback > 0) {
+        FMAC->PARAM = (FUNC_LOAD_Y << FMAC_PARAM_FUNC_Pos) |
+                      (feedback << FMAC_PARAM_P_Pos) | FMAC_PARAM_START;
+        for (unsigned int i = 0; i < feedback; i++)
+            FMAC->WDATA = 0;
+    }
+
+    // The filter then runs whenever there is input for it.
+    FMAC->CR = FMAC_CR_CLIPEN;
+    FMAC->PARAM = ((feedback > 0 ? FUNC_IIR : FUNC_FIR) << FMAC_PARAM_FUNC_Pos) |
+                  (feedforward << FMAC_PARAM_P_Pos) |
+                  (feedback << FMAC_PARAM_Q_Pos) |
+                  (shift << FMAC_PARAM_R_Pos) | FMAC_PARAM_START;
+
+    loaded = true;
+    return true;
+}
+
+bool loadFir(const int16_t *coeffs, unsigned int taps, unsigned int shift)
+{
+    return load(coeffs, taps, 0, shift);
+}
+
+bool loadIir(const int16_t *coeffs, unsigned int feedforward,
+             unsigned int feedback, unsigned int shift)
+{
+    return feedback > 0 && load(coeffs, feedforward, feedback, shift);
+}
+
+bool start(const int16_t *in, int16_t *out, unsigned int count)
+{
+    if (!loaded || running || count == 0 || count > MAX_BLOCK_SIZE)
+        return false;
+
+    std::copy(in, in + count, input_buffer.begin());
+    output = out;
+    output_count = count;
+    running = true;
+
+    constexpr uint32_t mode = STM32_DMA_CR_MINC | STM32_DMA_CR_PSIZE_HWORD |
+                              STM32_DMA_CR_MSIZE_HWORD | STM32_DMA_CR_PL(3);
+    dmaStreamSetMemory0(dma_read, output_buffer.data());
+    dmaStreamSetTransactionSize(dma_read, count);
+    dmaStreamSetMode(dma_read, mode | STM32_DMA_CR_DIR_P2M);
+    dmaStreamSetMemory0(dma_write, input_buffer.data());
+    dmaStreamSetTransactionSize(dma_write, count);
+    dmaStreamSetMode(dma_write, mode | STM32_DMA_CR_DIR_M2P);
+    dmaStreamEnable(dma_read);
+    dmaStreamEnable(dma_write);
+    FMAC->CR |= FMAC_CR_DMAREN | FMAC_CR_DMAWEN;
+    return true;
+}
+
+bool wait()
+{
+    if (!running)
+        return false;
+
+    while (dmaStreamGetTransactionSize(dma_read) > 0) {}
+
+    FMAC->CR &= ~(FMAC_CR_DMAREN | FMAC_CR_DMAWEN);
+    dmaStreamDisable(dma_write);
+    dmaStreamDisable(dma_read);
+    running = false;
+
+    std::copy(output_buffer.begin(), output_buffer.begin() + output_count, output);
+    return true;
+}
+
+void stop()
+{
+    if (dma_write != nullptr && dma_read != nullptr) {
+        dmaStreamDisable(dma_write);
+        dmaStreamDisable(dma_read);
+    }
+
+    FMAC->CR = FMAC_CR_RESET;
+    while (FMAC->CR & FMAC_CR_RESET);
+
+    loaded = false;
+    running = false;
+}
+
+}
+#else // L4
+namespace fmac {
+
+void init() {}
+
+bool loadFir(const int16_t *, unsigned int, unsigned int)
+{
+    return false;
+}
+
+bool loadIir(const int16_t *, unsigned int, unsigned int, unsigned int)
+{
+    return false;
+}
+
+bool start(const int16_t *, int16_t *, unsigned int)
+{
+    return false;
+}
+
+bool wait()
+{
+    return false;
+}
+
+void stop() {}
+
+}
+#endif
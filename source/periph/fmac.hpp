@@ -0,0 +1,63 @@
+/**
+ * @file fmac.hpp
+ * @brief Runs FIR and IIR filters on the H7's filter math accelerator.
+ *
+ * Algorithms load a filter once, then start each block in the background
+ * and wait for its results when they need them (through svc 5). Samples are
+ * q1.15. The L4 has no FMAC, so every call fails there.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_FMAC_HPP_
+#define STMDSP_FMAC_HPP_
+
+#include <cstdint>
+
+namespace fmac
+{
+    // Operations of the FMAC syscall, given in r0. r0 is set to whether the
+    // operation succeeded.
+    enum class Call : uint32_t {
+        LoadFir = 0, // r1 = coefficients, r2 = taps, r3 = shift
+        LoadIir,     // r1 = coefficients, r2 = feed-forward | feedback << 8,
+                     // r3 = shift
+        Start,       // r1 = input, r2 = output, r3 = count
+        Wait,
+        Stop
+    };
+
+    // The FMAC's 256 words hold the coefficients, then the inputs and the
+    // outputs that the filter reaches back to, each with a few words to
+    // spare. That fits FIRs of up to 123 taps, and IIRs with up to 124
+    // coefficients in total.
+    constexpr unsigned int MEMORY_SIZE = 256;
+    constexpr unsigned int MAX_BLOCK_SIZE = 4096;
+
+    void init();
+
+    // Loads y[n] = sum(coeffs[k] * x[n - k]) of 2 to 127 taps (as memory
+    // allows), with results shifted left by shift (0 to 7). History starts
+    // out zeroed.
+    bool loadFir(const int16_t *coeffs, unsigned int taps, unsigned int shift);
+    // Loads y[n] = sum(b[k] * x[n - k]) + sum(a[k] * y[n - k - 1]), where
+    // coeffs holds the feed-forward (b) then the feedback (a) coefficients:
+    // 2 to 64 of the former, and 1 to one fewer of the latter.
+    bool loadIir(const int16_t *coeffs, unsigned int feedforward,
+                 unsigned int feedback, unsigned int shift);
+
+    // Starts filtering a block in the background. Filter state carries over
+    // between blocks.
+    bool start(const int16_t *in, int16_t *out, unsigned int count);
+    // Waits for the started block, then writes its results out.
+    bool wait();
+    // Unloads the filter (done whenever the algorithm is unloaded or
+    // switched, so that the next does not inherit it).
+    void stop();
+}
+
+#endif // STMDSP_FMAC_HPP_
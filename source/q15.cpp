@@ -0,0 +1,121 @@
+/**
+ * @file q15.cpp
+ * @brief Q15 fixed-point filter kernels that algorithms may call directly.
+ *
+ * These run in the algorithm's unprivileged context, so everything here lives
+ * in .convcode. Helpers are force-inlined since the firmware is built at -O0.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "q15.hpp"
+
+#include "hal.h"
+
+// Loads two adjacent samples as one word (which may not be aligned).
+__attribute__((always_inline))
+static inline int32_t load2(const int16_t *p)
+{
+    struct __attribute__((packed)) pair { int32_t value; };
+    return reinterpret_cast<const pair *>(p)->value;
+}
+
+// Inserts a new sample into a {x[n-1], x[n-2]} pair.
+__attribute__((always_inline))
+static inline int32_t push2(int32_t pair, int32_t value)
+{
+    return static_cast<int32_t>((static_cast<uint32_t>(pair) << 16) | (value & 0xFFFF));
+}
+
+__attribute__((always_inline))
+static inline int16_t saturate(int32_t value)
+{
+#if defined(__ARM_FEATURE_DSP)
+    return __SSAT(value, 16);
+#else
+    return value < -32768 ? -32768 : (value > 32767 ? 32767 : value);
+#endif
+}
+
+namespace q15 {
+
+__attribute__((section(".convcode")))
+void fir(const int16_t *coeffs, unsigned int taps, int16_t *state,
+         const int16_t *in, int16_t *out, unsigned int size)
+{
+    // Append the block to the history so that x[n - k] is contiguous.
+    const int count = size;
+    const int length = taps;
+    auto x = state + length - 1;
+    for (int i = 0; i < count; i++)
+        x[i] = in[i];
+
+    for (int n = 0; n < count; n++) {
+        int64_t acc = 0;
+        int k = 0;
+#if defined(__ARM_FEATURE_DSP)
+        // Two taps per SMLALDX: {h[k], h[k+1]} against {x[n-k-1], x[n-k]}.
+        for (; k + 1 < length; k += 2)
+            acc = __SMLALDX(load2(coeffs + k), load2(x + n - k - 1), acc);
+#endif
+        for (; k < length; k++)
+            acc += coeffs[k] * x[n - k];
+        out[n] = saturate(static_cast<int32_t>(acc >> 15));
+    }
+
+    // Keep the last taps - 1 inputs for the next block.
+    for (int i = 0; i < length - 1; i++)
+        state[i] = state[count + i];
+}
+
+__attribute__((section(".convcode")))
+void biquad(const int16_t *coeffs, unsigned int stages, unsigned int shift,
+            int16_t *state, const int16_t *in, int16_t *out, unsigned int size)
+{
+    // The shift comes straight from algorithm code; past 15, the scaling
+    // shift below would be negative.
+    if (shift > 15)
+        shift = 15;
+
+    for (unsigned int s = 0; s < stages; s++) {
+        auto c = coeffs + s * 6;
+        auto st = state + s * 4;
+        auto src = s == 0 ? in : out;
+
+        const int32_t b0 = c[0];
+        [[maybe_unused]] const int32_t b12 = load2(c + 2);
+        [[maybe_unused]] const int32_t a12 = load2(c + 4);
+        int32_t xs = load2(st);
+        int32_t ys = load2(st + 2);
+
+        for (unsigned int n = 0; n < size; n++) {
+            const int32_t x = src[n];
+            int64_t acc = b0 * x;
+#if defined(__ARM_FEATURE_DSP)
+            // {b1, b2} against {x[n-1], x[n-2]}, {a1, a2} against {y[n-1], y[n-2]}.
+            acc = __SMLALD(b12, xs, acc);
+            acc = __SMLALD(a12, ys, acc);
+#else
+            acc += c[2] * static_cast<int16_t>(xs) + c[3] * (xs >> 16) +
+                   c[4] * static_cast<int16_t>(ys) + c[5] * (ys >> 16);
+#endif
+            // Scaling back up by 2^shift in the same shift keeps the low bits.
+            const int32_t y = saturate(static_cast<int32_t>(acc >> (15 - shift)));
+            xs = push2(xs, x);
+            ys = push2(ys, y);
+            out[n] = y;
+        }
+
+        st[0] = xs;
+        st[1] = xs >> 16;
+        st[2] = ys;
+        st[3] = ys >> 16;
+    }
+}
+
+} // namespace q15
+
@@ -0,0 +1,37 @@
+/**
+ * @file q15.hpp
+ * @brief Q15 fixed-point filter kernels that algorithms may call directly.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_Q15_HPP
+#define STMDSP_Q15_HPP
+
+#include <cstdint>
+
+namespace q15
+{
+    // FIR filter: out[n] = sum(coeffs[k] * x[n - k]) for k < taps.
+    // state must hold taps + size - 1 samples and be zeroed before the first
+    // block; it carries the filter history between blocks. in and out may
+    // be the same buffer.
+    void fir(const int16_t *coeffs, unsigned int taps, int16_t *state,
+             const int16_t *in, int16_t *out, unsigned int size);
+
+    // Cascade of direct form I biquads, with the CMSIS-DSP coefficient layout
+    // of {b0, 0, b1, b2, a1, a2} per stage (a1 and a2 negated, so that each
+    // term is added). Coefficients are scaled down by 2^shift (at most 15,
+    // larger shifts are taken as 15) to fit Q15.
+    // state holds {x[n-1], x[n-2], y[n-1], y[n-2]} per stage, zeroed before
+    // the first block. in and out may be the same buffer.
+    void biquad(const int16_t *coeffs, unsigned int stages, unsigned int shift,
+                int16_t *state, const int16_t *in, int16_t *out, unsigned int size);
+}
+
+#endif // STMDSP_Q15_HPP
+
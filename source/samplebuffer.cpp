@@ -12,20 +12,23 @@
 #include "samplebuffer.hpp"
 
 SampleBuffer::SampleBuffer(Sample *buffer) :
-    m_buffer(buffer) {}
+    m_base(buffer), m_buffer(buffer) {}
 
 void SampleBuffer::clear() {
     std::fill(m_buffer, m_buffer + m_size, 2048);
 }
+void SampleBuffer::clear(unsigned int index) {
+    std::fill(slot(index), slot(index) + m_slot_size, 2048);
+}
 __attribute__((section(".convcode")))
-void SampleBuffer::modify(Sample *data, unsigned int srcsize) {
-    auto size = srcsize < m_size ? srcsize : m_size;
+void SampleBuffer::modify(unsigned int index, Sample *data, unsigned int srcsize) {
+    auto size = srcsize < m_slot_size ? srcsize : m_slot_size;
     size = (size + 15) & (~15);
 
-    m_modified = m_buffer;
+    m_modified = slot(index);
     const int *src = reinterpret_cast<const int *>(data);
     const int * const srcend = src + (size / 2);
-    int *dst = reinterpret_cast<int *>(m_buffer);
+    int *dst = reinterpret_cast<int *>(m_modified);
     do {
         int a = src[0];
         int b = src[1];
@@ -48,56 +51,37 @@ void SampleBuffer::modify(Sample *data, unsigned int srcsize) {
     } while (src < srcend);
 }
 __attribute__((section(".convcode")))
-void SampleBuffer::midmodify(Sample *data, unsigned int srcsize) {
-    auto size = srcsize < m_size / 2 ? srcsize : m_size / 2;
-    size = (size + 15) & (~15);
-
-    m_modified = middata();
-    const int *src = reinterpret_cast<const int *>(data);
-    const int * const srcend = src + (size / 2);
-    int *dst = reinterpret_cast<int *>(middata());
-    do {
-        int a = src[0];
-        int b = src[1];
-        int c = src[2];
-        int d = src[3];
-        int e = src[4];
-        int f = src[5];
-        int g = src[6];
-        int h = src[7];
-        dst[0] = a;
-        dst[1] = b;
-        dst[2] = c;
-        dst[3] = d;
-        dst[4] = e;
-        dst[5] = f;
-        dst[6] = g;
-        dst[7] = h;
-        src += 8;
-        dst += 8;
-    } while (src < srcend);
+void SampleBuffer::setModified(unsigned int index) {
+    m_modified = slot(index);
 }
 
-void SampleBuffer::setModified() {
-    m_modified = m_buffer;
+void SampleBuffer::setSize(unsigned int size) {
+    m_size = size < MAX_SAMPLE_BUFFER_SIZE ? size : MAX_SAMPLE_BUFFER_SIZE;
+    m_slot_size = m_size / m_slots;
 }
 
-void SampleBuffer::setMidmodified() {
-    m_modified = middata();
+void SampleBuffer::setSlots(unsigned int count) {
+    m_slots = count;
+    setSize(m_slot_size * count);
 }
 
-void SampleBuffer::setSize(unsigned int size) {
-    m_size = size < MAX_SAMPLE_BUFFER_SIZE ? size : MAX_SAMPLE_BUFFER_SIZE;
+void SampleBuffer::setGuard(unsigned int count) {
+    // Rounded up to keep the buffer word-aligned.
+    m_buffer = m_base + ((count + 1) & ~1);
+    std::fill(m_base, m_buffer, 2048);
 }
 
 __attribute__((section(".convcode")))
 Sample *SampleBuffer::data() {
     return m_buffer;
 }
-__attribute__((section(".convcode")))
 Sample *SampleBuffer::middata() {
     return m_buffer + m_size / 2;
 }
+__attribute__((section(".convcode")))
+Sample *SampleBuffer::slot(unsigned int index) {
+    return m_buffer + index * m_slot_size;
+}
 uint8_t *SampleBuffer::bytedata() {
     return reinterpret_cast<uint8_t *>(m_buffer);
 }
@@ -115,3 +99,12 @@ unsigned int SampleBuffer::bytesize() const {
     return m_size * sizeof(Sample);
 }
 
+__attribute__((section(".convcode")))
+unsigned int SampleBuffer::slots() const {
+    return m_slots;
+}
+__attribute__((section(".convcode")))
+unsigned int SampleBuffer::slotsize() const {
+    return m_slot_size;
+}
+
@@ -19,6 +19,7 @@ using Sample = uint16_t;
 
 constexpr unsigned int MAX_SAMPLE_BUFFER_BYTESIZE = sizeof(Sample) * 8192;
 constexpr unsigned int MAX_SAMPLE_BUFFER_SIZE = MAX_SAMPLE_BUFFER_BYTESIZE / sizeof(Sample);
+constexpr unsigned int MAX_SAMPLE_BUFFER_SLOTS = 8;
 
 class SampleBuffer
 {
@@ -26,24 +27,38 @@ public:
     SampleBuffer(Sample *buffer);
 
     void clear();
+    void clear(unsigned int index);
 
-    void modify(Sample *data, unsigned int srcsize);
-    void midmodify(Sample *data, unsigned int srcsize);
-    void setModified();
-    void setMidmodified();
+    // The buffer is divided into equally-sized slots (two by default: the
+    // halves of a circular DMA transfer).
+    void modify(unsigned int index, Sample *data, unsigned int srcsize);
+    void setModified(unsigned int index);
     Sample *modified();
 
     Sample *data();
     Sample *middata();
+    Sample *slot(unsigned int index);
     uint8_t *bytedata();
 
     void setSize(unsigned int size);
     unsigned int size() const;
     unsigned int bytesize() const;
 
+    // Changes the slot count, keeping the slot size.
+    void setSlots(unsigned int count);
+    unsigned int slots() const;
+    unsigned int slotsize() const;
+
+    // Moves the buffer forward to leave room for (at least) count samples in
+    // front of it, filled with silence. The buffer size is not changed.
+    void setGuard(unsigned int count);
+
 private:
+    Sample *m_base = nullptr;
     Sample *m_buffer = nullptr;
     unsigned int m_size = MAX_SAMPLE_BUFFER_SIZE;
+    unsigned int m_slots = 2;
+    unsigned int m_slot_size = MAX_SAMPLE_BUFFER_SIZE / 2;
     Sample *m_modified = nullptr;
 };
 
@@ -25,6 +25,11 @@ SampleBuffer Samples::In (reinterpret_cast<Sample *>(0x38000000)); // 16k
 __attribute__((section(".convdata")))
 SampleBuffer Samples::Out (reinterpret_cast<Sample *>(0x30004000)); // 16k
 SampleBuffer Samples::SigGen (reinterpret_cast<Sample *>(0x30000000)); // 16k
+#elif defined(TARGET_PLATFORM_SIM)
+static std::array<Sample, MAX_SAMPLE_BUFFER_SIZE> sim_buffers[3];
+SampleBuffer Samples::In (sim_buffers[0].data());
+SampleBuffer Samples::Out (sim_buffers[1].data());
+SampleBuffer Samples::Generator (sim_buffers[2].data());
 #else
 __attribute__((section(".convdata")))
 SampleBuffer Samples::In (reinterpret_cast<Sample *>(0x20008000)); // 16k
@@ -76,3 +76,18 @@ unsigned int SClock::getRate()
     return static_cast<unsigned int>(-1);
 }
 
+unsigned int SClock::getFrequency()
+{
+    return m_timer_config.frequency / m_div;
+}
+
+unsigned int SClock::getPeriodCycles()
+{
+#if defined(TARGET_PLATFORM_H7)
+    constexpr uint64_t core_frequency = STM32_CORE_CK;
+#else
+    constexpr uint64_t core_frequency = STM32_HCLK;
+#endif
+
+    return m_div * core_frequency / m_timer_config.frequency;
+}
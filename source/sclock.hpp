@@ -34,6 +34,10 @@ public:
 
     static void setRate(Rate rate);
     static unsigned int getRate();
+    // Returns the sample rate in Hz.
+    static unsigned int getFrequency();
+    // Returns the sample period in core clock cycles.
+    static unsigned int getPeriodCycles();
 
 private:
     static GPTDriver *m_timer;
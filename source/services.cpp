@@ -0,0 +1,35 @@
+/**
+ * @file services.cpp
+ * @brief Table of firmware services that algorithms may call directly.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "services.hpp"
+
+#include "adc.hpp"
+#include "cordic.hpp"
+#include "fft.hpp"
+#include "messagelog.hpp"
+#include "parameters.hpp"
+#include "q15.hpp"
+
+// The linker scripts place .convcode.services first in flashc.
+__attribute__((section(".convcode.services"), used))
+const ServiceTable serviceTable = {
+    .version = SERVICE_TABLE_VERSION,
+    .count = (sizeof(ServiceTable) - 2 * sizeof(uint32_t)) / sizeof(void (*)()),
+
+    .q15_fir = q15::fir,
+    .q15_biquad = q15::biquad,
+    .fft_real = fft::real,
+    .fft_real_inverse = fft::realInverse,
+    .math_vector = cordic::vector,
+    .knobs = ADC::m_alt_values.data(),
+    .parameters = Parameters::m_values.data(),
+    .log_write = MessageLog::write,
+};
@@ -0,0 +1,63 @@
+/**
+ * @file services.hpp
+ * @brief Table of firmware services that algorithms may call directly.
+ *
+ * The table is placed at the start of the unprivileged code region (flashc,
+ * 0x0807C000 on both targets) so that algorithms can find it without a
+ * syscall. Entries are only ever appended: algorithms should check that
+ * `count` covers the entries they use.
+ *
+ * These are plain calls, without the cost of a trap into port_syscall; only
+ * what needs privilege (waiting for samples, time measurement, DMA-driven
+ * peripherals) is left to svc.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_SERVICES_HPP
+#define STMDSP_SERVICES_HPP
+
+#include <cstdint>
+
+constexpr uint32_t SERVICE_TABLE_VERSION = 6;
+
+struct ServiceTable
+{
+    uint32_t version;
+    // Number of entries that follow.
+    uint32_t count;
+
+    // See q15.hpp.
+    void (*q15_fir)(const int16_t *coeffs, unsigned int taps, int16_t *state,
+                    const int16_t *in, int16_t *out, unsigned int size);
+    void (*q15_biquad)(const int16_t *coeffs, unsigned int stages, unsigned int shift,
+                       int16_t *state, const int16_t *in, int16_t *out, unsigned int size);
+
+    // See fft.hpp (version 2).
+    bool (*fft_real)(float *data, unsigned int size);
+    bool (*fft_real_inverse)(float *data, unsigned int size);
+
+    // See cordic::vector() (version 3). Same as the math syscall with
+    // cordic::VECTOR set.
+    void (*math_vector)(unsigned int func, const float *in, float *out, unsigned int count);
+
+    // The two knobs, as 12-bit readings updated in the background
+    // (version 4). Same as the svc 3 readings, without the trap.
+    const volatile uint16_t *knobs;
+
+    // The 64 parameter words set by the host's 'P' command (version 5).
+    // Updates only land between blocks, so a block sees each batch whole.
+    const volatile uint32_t *parameters;
+
+    // See MessageLog::write() (version 6): logs bytes for the host's 'u'
+    // command, returning false if they were dropped for lack of room.
+    bool (*log_write)(const char *data, unsigned int size);
+};
+
+extern const ServiceTable serviceTable;
+
+#endif // STMDSP_SERVICES_HPP
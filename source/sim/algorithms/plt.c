@@ -0,0 +1,37 @@
+/**
+ * @file plt.c
+ * @brief Relocatable test algorithm that calls a global function and reads a
+ *        global variable, so that the loader must fill in its GOT.
+ *
+ * Build it as a relocatable simulator algorithm:
+ *   gcc -m32 -O2 -ffreestanding -nostdlib -fPIC -shared -e process
+ *       plt.c -o plt.elf
+ * The call to offset() goes through the PLT (R_386_JMP_SLOT), and the read
+ * of gain through the GOT (R_386_GLOB_DAT). Run as
+ *   stmdsp-sim -e plt.elf -i input.raw -o output.raw
+ * every output sample is its input sample times gain, plus 16. A loader that
+ * adds the linker's lazy-binding address to these slots crashes instead.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+typedef unsigned short Sample;
+
+unsigned int gain = 1;
+
+__attribute__((noinline))
+Sample offset(Sample sample)
+{
+    return sample + 16;
+}
+
+Sample *process(Sample *samples, unsigned int size)
+{
+    for (unsigned int i = 0; i < size; i++)
+        samples[i] = offset(samples[i] * gain);
+    return samples;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file hal.h
+ * @brief Minimal stand-in for the ChibiOS HAL in the host simulation build.
+ *
+ * Only the driver types named by the peripheral headers are provided. The
+ * simulated drivers in sim/periph keep their state in these structures so
+ * that the simulator can play the role of the DMA hardware.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_SIM_HAL_H
+#define STMDSP_SIM_HAL_H
+
+#include "ch.h"
+
+#include <cstddef>
+#include <cstdint>
+
+using adcsample_t = uint16_t;
+using dacsample_t = uint16_t;
+
+struct ADCDriver {
+    adcsample_t *samples = nullptr;
+    size_t depth = 0;
+    bool complete = false;
+};
+struct ADCConfig {};
+struct ADCConversionGroup {};
+
+#define adcIsBufferComplete(adcp) ((adcp)->complete)
+
+struct DACDriver {
+    const dacsample_t *samples = nullptr;
+    size_t depth = 0;
+};
+struct DACConfig {};
+struct DACConversionGroup {};
+
+struct GPTDriver {};
+struct GPTConfig {};
+
+struct USBConfig {};
+struct SerialUSBConfig {};
+struct SerialUSBDriver {};
+
+extern ADCDriver ADCD1;
+extern DACDriver DACD1;
+extern DACDriver DACD2;
+
+#endif // STMDSP_SIM_HAL_H
+
@@ -0,0 +1,191 @@
+/**
+ * @file main.cpp
+ * @brief Host simulation entry point.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "adc.hpp"
+#include "dac.hpp"
+#include "elfload.hpp"
+#include "error.hpp"
+#include "sclock.hpp"
+#include "samples.hpp"
+#include "simulator.hpp"
+#include "usbserial.hpp"
+
+#include "runstatus.hpp"
+RunStatus run_status = RunStatus::Idle;
+
+#include "conversion.hpp"
+#include "communication.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Algorithms for the simulator are host (IA32) ELFs linked to run from
+// ALGORITHM_ADDRESS:
+//   gcc -m32 -O2 -ffreestanding -nostdlib -static -e process
+//       -Wl,-Ttext-segment=0x10000000 algo.c -o algo.elf
+// or relocatable ones, which are placed there by the loader:
+//   gcc -m32 -O2 -ffreestanding -nostdlib -fPIC -shared -e process
+//       algo.c -o algo.elf
+// (source/sim/algorithms/plt.c is such an algorithm, calling through its PLT).
+// As on the target, an algorithm may define "const unsigned int block_size"
+// to be called with blocks of that size rather than the slot size.
+
+static void usage(const char *name)
+{
+    std::fprintf(stderr,
+        "Usage: %s [-e algo.elf] [-i input.raw] [-o output.raw] [-r rate]\n"
+        "          [-b block_size] [-n depth] [-c block,sample] [-s cpu_scale]\n"
+        "          [-k knob1,knob2] [-m mode] [-p policy]\n"
+        "Samples are raw little-endian 12-bit codes, as read by the 'a' command.\n"
+        "Rate is 0-5 (8k, 16k, 20k, 32k, 48k, 96k). Depth is the number of\n"
+        "block-sized slots in the sample rings (even, 2 by default, as set by\n"
+        "the 'N' command). Mode is the conversion mode set by the 'C' command\n"
+        "(0 = copy, 1 = in-place, 2 = float, 3 = Q15). Policy is the overrun\n"
+        "policy set by the 'O' command (0 = abort, 1 = repeat, 2 = bypass,\n"
+        "3 = silence).\n"
+        "Each block is charged the given core cycles, plus the given cycles per\n"
+        "sample (1000,20 by default). -s instead charges the algorithm's host\n"
+        "CPU time, scaled by cpu_scale; results then vary from run to run.\n"
+        "Without -i, the firmware protocol is served over stdin/stdout.\n", name);
+    std::exit(1);
+}
+
+static std::FILE *algorithm_file = nullptr;
+
+static size_t readAlgorithmFile(unsigned char *dst, size_t count)
+{
+    return std::fread(dst, 1, count, algorithm_file);
+}
+
+static bool loadAlgorithmFile(const char *path)
+{
+    auto file = std::fopen(path, "rb");
+    if (file == nullptr)
+        return false;
+
+    std::fseek(file, 0, SEEK_END);
+    auto size = std::ftell(file);
+    std::rewind(file);
+
+    algorithm_file = file;
+    auto success = size > 0 && ELFManager::load(size, readAlgorithmFile);
+    std::fclose(file);
+    return success;
+}
+
+int main(int argc, char **argv)
+{
+    const char *elf = nullptr;
+    const char *input = nullptr;
+    const char *output = nullptr;
+    unsigned int rate = static_cast<unsigned int>(SClock::Rate::R32K);
+    unsigned int block = 0;
+    unsigned int depth = 2;
+    unsigned int mode = static_cast<unsigned int>(ConversionMode::Copy);
+    unsigned int policy = static_cast<unsigned int>(OverrunPolicy::Abort);
+
+    for (int opt; (opt = getopt(argc, argv, "e:i:o:r:b:n:c:s:k:m:p:h")) != -1;) {
+        switch (opt) {
+        case 'e': elf = optarg; break;
+        case 'i': input = optarg; break;
+        case 'o': output = optarg; break;
+        case 'r': rate = std::atoi(optarg); break;
+        case 'b': block = std::atoi(optarg); break;
+        case 'n': depth = std::atoi(optarg); break;
+        case 'm': mode = std::atoi(optarg); break;
+        case 'p': policy = std::atoi(optarg); break;
+        case 's': sim::setCpuScale(std::atof(optarg)); break;
+        case 'c':
+            {
+                unsigned int block_cycles = 0, sample_cycles = 0;
+                if (std::sscanf(optarg, "%u,%u", &block_cycles, &sample_cycles) < 1)
+                    usage(argv[0]);
+                sim::setCycleModel(block_cycles, sample_cycles);
+            }
+            break;
+        case 'k':
+            {
+                unsigned int k1 = 2048, k2 = 2048;
+                std::sscanf(optarg, "%u,%u", &k1, &k2);
+                sim::setKnob(0, k1);
+                sim::setKnob(1, k2);
+            }
+            break;
+        default: usage(argv[0]); break;
+        }
+    }
+
+    if (rate > static_cast<unsigned int>(SClock::Rate::R96K) ||
+        depth < 2 || depth % 2 != 0 || depth > MAX_SAMPLE_BUFFER_SLOTS ||
+        mode >= static_cast<unsigned int>(ConversionMode::Count) ||
+        policy >= static_cast<unsigned int>(OverrunPolicy::Count) || !sim::open(input, output))
+    {
+        usage(argv[0]);
+    }
+
+    // Reserve the region algorithms are linked for.
+    auto region = mmap(reinterpret_cast<void *>(ALGORITHM_ADDRESS), ALGORITHM_SIZE,
+                       PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (region == MAP_FAILED) {
+        std::perror("mmap");
+        return 1;
+    }
+
+    chSysInit();
+
+    ADC::begin();
+    DAC::begin();
+    SClock::begin();
+    USBSerial::begin();
+
+    SClock::setRate(static_cast<SClock::Rate>(rate));
+    ADC::setRate(static_cast<SClock::Rate>(rate));
+
+    ConversionManager::begin();
+    CommunicationManager::begin();
+
+    if (elf != nullptr && !loadAlgorithmFile(elf)) {
+        std::fprintf(stderr, "Failed to load %s\n", elf);
+        return 1;
+    }
+
+    ConversionManager::setMode(static_cast<ConversionMode>(mode));
+    ConversionManager::setOverrunPolicy(static_cast<OverrunPolicy>(policy));
+
+    if (block == 0)
+        block = Samples::In.slotsize();
+    if (block * depth > MAX_SAMPLE_BUFFER_SIZE)
+        usage(argv[0]);
+    Samples::In.setSlots(depth);
+    Samples::Out.setSlots(depth);
+    Samples::In.setSize(block * depth);
+    Samples::Out.setSize(block * depth);
+
+    // With an input file, run it through the pipeline until it runs out.
+    if (input != nullptr) {
+        if (!ConversionManager::canStart()) {
+            std::fprintf(stderr, "Block size not supported by this mode or algorithm\n");
+            return 1;
+        }
+        run_status = RunStatus::Running;
+        ConversionManager::start();
+    }
+
+    chThdSleep(TIME_INFINITE);
+    return 0;
+}
+
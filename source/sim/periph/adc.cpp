@@ -0,0 +1,74 @@
+/**
+ * @file adc.cpp
+ * @brief Simulated ADC: the simulator fills the buffer at the virtual rate.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "adc.hpp"
+#include "simulator.hpp"
+
+ADCDriver *ADC::m_driver = &ADCD1;
+
+adcsample_t *ADC::m_current_buffer = nullptr;
+size_t ADC::m_current_buffer_size = 0;
+ADC::Operation ADC::m_operation = nullptr;
+
+std::array<adcsample_t, 2> ADC::m_alt_values = {{ 2048, 2048 }};
+
+void ADC::begin()
+{
+    m_alt_values = {{ sim::knob(0), sim::knob(1) }};
+}
+
+void ADC::start(adcsample_t *buffer, size_t count, Operation operation)
+{
+    m_current_buffer = buffer;
+    m_current_buffer_size = count;
+    m_operation = operation;
+
+    m_driver->samples = buffer;
+    m_driver->depth = count;
+    SClock::start();
+    sim::adcStarted();
+}
+
+void ADC::stop()
+{
+    sim::adcStopped();
+    SClock::stop();
+
+    m_current_buffer = nullptr;
+    m_current_buffer_size = 0;
+    m_operation = nullptr;
+}
+
+adcsample_t ADC::readAlt(unsigned int id)
+{
+    return id < m_alt_values.size() ? m_alt_values[id] : 0;
+}
+
+void ADC::setRate(SClock::Rate)
+{
+}
+
+void ADC::setOperation(ADC::Operation operation)
+{
+    m_operation = operation;
+}
+
+void ADC::conversionCallback(ADCDriver *driver)
+{
+    if (m_operation != nullptr) {
+        auto half_size = m_current_buffer_size / 2;
+        if (adcIsBufferComplete(driver))
+            m_operation(m_current_buffer + half_size, half_size);
+        else
+            m_operation(m_current_buffer, half_size);
+    }
+}
+
@@ -0,0 +1,50 @@
+/**
+ * @file dac.cpp
+ * @brief Simulated DAC: the simulator records the buffer as it is played.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "dac.hpp"
+#include "sclock.hpp"
+
+DACDriver *DAC::m_driver[2] = {
+    &DACD1, &DACD2
+};
+
+void DAC::begin()
+{
+}
+
+void DAC::start(int channel, dacsample_t *buffer, size_t count)
+{
+    if (channel >= 0 && channel < 2) {
+        m_driver[channel]->samples = buffer;
+        m_driver[channel]->depth = count;
+        SClock::start();
+    }
+}
+
+int DAC::sigGenWantsMore()
+{
+    return -1;
+}
+
+int DAC::isSigGenRunning()
+{
+    return m_driver[1]->samples != nullptr;
+}
+
+void DAC::stop(int channel)
+{
+    if (channel >= 0 && channel < 2) {
+        m_driver[channel]->samples = nullptr;
+        m_driver[channel]->depth = 0;
+        SClock::stop();
+    }
+}
+
@@ -0,0 +1,53 @@
+/**
+ * @file flash.cpp
+ * @brief Simulated algorithm store flash, kept in memory for the run.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flash.hpp"
+
+#include <algorithm>
+#include <array>
+
+// Starts out erased, as a new board's would be.
+static std::array<unsigned char, Flash::SIZE> storage = [] {
+    std::array<unsigned char, Flash::SIZE> a;
+    a.fill(0xFF);
+    return a;
+}();
+
+const unsigned char *Flash::data()
+{
+    return storage.data();
+}
+
+bool Flash::erase(size_t offset, size_t size)
+{
+    if (offset >= SIZE || size > SIZE - offset)
+        return false;
+
+    const auto begin = offset / ERASE_SIZE * ERASE_SIZE;
+    const auto end = std::min(SIZE, (offset + size + ERASE_SIZE - 1) / ERASE_SIZE * ERASE_SIZE);
+    std::fill(storage.begin() + begin, storage.begin() + end, 0xFF);
+    return true;
+}
+
+// Like the hardware, programming can only clear bits.
+bool Flash::write(size_t offset, const unsigned char *src, size_t size)
+{
+    if (offset % WRITE_SIZE != 0 || size % WRITE_SIZE != 0 ||
+        offset >= SIZE || size > SIZE - offset)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < size; i++)
+        storage[offset + i] &= src[i];
+
+    return true;
+}
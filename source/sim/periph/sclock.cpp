@@ -0,0 +1,68 @@
+/**
+ * @file sclock.cpp
+ * @brief Simulated sampling clock; the simulator derives timing from the rate.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "sclock.hpp"
+#include "simulator.hpp"
+
+GPTDriver *SClock::m_timer = nullptr;
+unsigned int SClock::m_div = 1125;
+unsigned int SClock::m_runcount = 0;
+
+// Same divisors as the L4 target, so that 'r' replies match the hardware.
+const std::array<unsigned int, 6> SClock::m_rate_divs = {{
+    /* 8k  */ 4500,
+    /* 16k */ 2250,
+    /* 20k */ 1800,
+    /* 32k */ 1125,
+    /* 48k */ 750,
+    /* 96k */ 375
+}};
+
+void SClock::begin()
+{
+}
+
+void SClock::start()
+{
+    m_runcount++;
+}
+
+void SClock::stop()
+{
+    if (m_runcount > 0)
+        m_runcount--;
+}
+
+void SClock::setRate(SClock::Rate rate)
+{
+    m_div = m_rate_divs[static_cast<unsigned int>(rate)];
+}
+
+unsigned int SClock::getRate()
+{
+    for (unsigned int i = 0; i < m_rate_divs.size(); ++i) {
+        if (m_rate_divs[i] == m_div)
+            return i;
+    }
+
+    return static_cast<unsigned int>(-1);
+}
+
+unsigned int SClock::getFrequency()
+{
+    return 36'000'000 / m_div;
+}
+
+unsigned int SClock::getPeriodCycles()
+{
+    // The L4's sample clock timer runs at 36MHz.
+    return m_div * sim::CORE_FREQUENCY / 36'000'000;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file usbserial.cpp
+ * @brief Simulated USB serial link over the process's stdin/stdout.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "usbserial.hpp"
+
+#include <poll.h>
+#include <unistd.h>
+
+SerialUSBDriver *USBSerial::m_driver = nullptr;
+
+void USBSerial::begin()
+{
+}
+
+bool USBSerial::isActive()
+{
+    pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+size_t USBSerial::read(unsigned char *buffer, size_t count)
+{
+    size_t total = 0;
+    while (total < count) {
+        auto n = ::read(STDIN_FILENO, buffer + total, count - total);
+        if (n <= 0)
+            break;
+        total += n;
+    }
+
+    return total;
+}
+
+size_t USBSerial::write(const unsigned char *buffer, size_t count)
+{
+    size_t total = 0;
+    while (total < count) {
+        auto n = ::write(STDOUT_FILENO, buffer + total, count - total);
+        if (n <= 0)
+            break;
+        total += n;
+    }
+
+    return total;
+}
+
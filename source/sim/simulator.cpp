@@ -0,0 +1,283 @@
+/**
+ * @file simulator.cpp
+ * @brief Virtual-time engine for the host simulation build.
+ *
+ * SIMIA32 has no preemption, so interrupts are delivered at two points: from
+ * the idle thread (the whole system is waiting, so time jumps straight to the
+ * next event), and from the runner after each algorithm call (the block's
+ * cost is charged to the clock, and any ADC interrupts that would have
+ * preempted it are fired in order). The cost comes from a fixed cycle model
+ * (cycles per block plus cycles per sample), so every run of the same input
+ * gives the same latencies, misses and overruns. This reproduces the
+ * mailbox/overrun behavior of the hardware much faster than real time.
+ * Charging the algorithm's scaled host execution time instead is available
+ * as an opt-in, at the cost of that determinism.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "simulator.hpp"
+
+#include "ch.h"
+#include "hal.h"
+
+#include "conversion.hpp"
+#include "periph/adc.hpp"
+#include "sclock.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <ctime>
+#include <limits>
+
+ADCDriver ADCD1;
+DACDriver DACD1;
+DACDriver DACD2;
+
+// Defined in handlers.cpp on hardware; the runner fills this in directly here.
+extern "C" {
+time_measurement_t conversion_time_measurement;
+}
+
+namespace sim {
+
+static constexpr std::array<uint64_t, 6> sampleRates {{
+    8000, 16000, 20000, 32000, 48000, 96000
+}};
+static constexpr uint64_t tickPeriod = 1'000'000'000 / CH_CFG_ST_FREQUENCY;
+
+static FILE *inputFile = nullptr;
+static FILE *outputFile = nullptr;
+static double cpuScale = 1.0;
+static bool hostTiming = false;
+static uint64_t cyclesPerBlock = 1000;
+static uint64_t cyclesPerSample = 20;
+static std::array<uint16_t, 2> knobs {{ 2048, 2048 }};
+
+// Virtual time, in nanoseconds.
+static uint64_t now = 0;
+static uint64_t nextTick = tickPeriod;
+static uint64_t nextHalf = 0;
+static uint64_t halfPeriod = 0;
+static bool adcRunning = false;
+static bool secondHalf = false;
+static std::array<uint64_t, 2> halfTime = {};
+
+static timespec blockStart;
+static uint64_t blockIsrTime = 0;
+static uint64_t blockSize = 0;
+
+static struct {
+    uint64_t blocks = 0;
+    uint64_t misses = 0;
+    uint64_t aborts = 0;
+    uint64_t latencyMin = std::numeric_limits<uint64_t>::max();
+    uint64_t latencyMax = 0;
+    uint64_t latencySum = 0;
+} stats;
+
+static void finish()
+{
+    if (outputFile != nullptr)
+        std::fclose(outputFile);
+    report(stderr);
+    std::exit(0);
+}
+
+static void fireTick()
+{
+    CH_IRQ_PROLOGUE();
+    chSysLockFromISR();
+    chSysTimerHandlerI();
+    chSysUnlockFromISR();
+    CH_IRQ_EPILOGUE();
+}
+
+static void fireAdcHalf()
+{
+    const auto half = ADCD1.depth / 2;
+    const auto offset = secondHalf ? half : 0;
+
+    // The DAC runs off of the same clock, so it has just finished playing
+    // out this half of its buffer.
+    if (outputFile != nullptr && DACD1.samples != nullptr)
+        std::fwrite(DACD1.samples + offset, sizeof(dacsample_t), half, outputFile);
+
+    auto samples = ADCD1.samples + offset;
+    if (inputFile != nullptr) {
+        if (std::fread(samples, sizeof(adcsample_t), half, inputFile) < half)
+            finish();
+    } else {
+        std::fill(samples, samples + half, 2048);
+    }
+
+    halfTime[secondHalf] = now;
+    ADCD1.complete = secondHalf;
+    CH_IRQ_PROLOGUE();
+    ADC::conversionCallback(&ADCD1);
+    CH_IRQ_EPILOGUE();
+}
+
+static uint64_t nextEvent()
+{
+    return adcRunning ? std::min(nextTick, nextHalf) : nextTick;
+}
+
+static void advanceTo(uint64_t time)
+{
+    for (auto next = nextEvent(); next <= time; next = nextEvent()) {
+        now = next;
+        if (adcRunning && nextHalf == now) {
+            fireAdcHalf();
+            nextHalf += halfPeriod;
+            secondHalf = !secondHalf;
+        } else {
+            fireTick();
+            nextTick += tickPeriod;
+        }
+    }
+
+    now = time;
+}
+
+bool open(const char *input, const char *output)
+{
+    if (input != nullptr && (inputFile = std::fopen(input, "rb")) == nullptr)
+        return false;
+    if (output != nullptr && (outputFile = std::fopen(output, "wb")) == nullptr)
+        return false;
+    return true;
+}
+
+void setCycleModel(unsigned int perBlock, unsigned int perSample)
+{
+    cyclesPerBlock = perBlock;
+    cyclesPerSample = perSample;
+}
+
+void setCpuScale(double scale)
+{
+    cpuScale = scale;
+    hostTiming = true;
+}
+
+void setKnob(unsigned int id, uint16_t value)
+{
+    if (id < knobs.size())
+        knobs[id] = value;
+}
+
+uint16_t knob(unsigned int id)
+{
+    return id < knobs.size() ? knobs[id] : 0;
+}
+
+void adcStarted()
+{
+    auto rate = sampleRates[std::min<std::size_t>(SClock::getRate(), sampleRates.size() - 1)];
+    halfPeriod = ADCD1.depth / 2 * 1'000'000'000ull / rate;
+    nextHalf = now + halfPeriod;
+    secondHalf = false;
+    adcRunning = true;
+}
+
+void adcStopped()
+{
+    adcRunning = false;
+}
+
+void beginBlock(const void *samples, unsigned int size)
+{
+    auto second = static_cast<const adcsample_t *>(samples) >= ADCD1.samples + ADCD1.depth / 2;
+    blockIsrTime = halfTime[second];
+    blockSize = size;
+    if (hostTiming)
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &blockStart);
+}
+
+uint32_t endBlock()
+{
+    uint64_t elapsed;
+    if (hostTiming) {
+        timespec end;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &end);
+        auto host = (end.tv_sec - blockStart.tv_sec) * 1'000'000'000ll +
+                    (end.tv_nsec - blockStart.tv_nsec);
+        elapsed = static_cast<uint64_t>(host * cpuScale);
+    } else {
+        auto cycles = cyclesPerBlock + cyclesPerSample * blockSize;
+        elapsed = cycles * 1'000'000'000 / CORE_FREQUENCY;
+    }
+
+    advanceTo(now + elapsed);
+
+    auto latency = now - blockIsrTime;
+    stats.blocks++;
+    stats.latencySum += latency;
+    stats.latencyMin = std::min(stats.latencyMin, latency);
+    stats.latencyMax = std::max(stats.latencyMax, latency);
+    if (latency > halfPeriod)
+        stats.misses++;
+
+    return static_cast<uint32_t>(elapsed * CORE_FREQUENCY / 1'000'000'000);
+}
+
+uint32_t cycleCount()
+{
+    return static_cast<uint32_t>(now * CORE_FREQUENCY / 1'000'000'000);
+}
+
+void conversionAborted()
+{
+    stats.aborts++;
+}
+
+void report(FILE *stream)
+{
+    std::fprintf(stream, "blocks:   %llu\n", static_cast<unsigned long long>(stats.blocks));
+    std::fprintf(stream, "period:   %.2f us\n", halfPeriod / 1000.);
+    if (stats.blocks > 0) {
+        std::fprintf(stream, "latency:  min %.2f us, mean %.2f us, max %.2f us\n",
+                     stats.latencyMin / 1000.,
+                     stats.latencySum / 1000. / stats.blocks,
+                     stats.latencyMax / 1000.);
+    }
+    std::fprintf(stream, "misses:   %llu\n", static_cast<unsigned long long>(stats.misses));
+
+    // As reported by the 'T' command.
+    auto exec = ConversionManager::getStats();
+    if (exec.count > 0) {
+        std::fprintf(stream, "cycles:   min %lu, mean %lu, max %lu (%lu per block, %lu over)\n",
+                     static_cast<unsigned long>(exec.min),
+                     static_cast<unsigned long>(exec.mean),
+                     static_cast<unsigned long>(exec.max),
+                     static_cast<unsigned long>(exec.period),
+                     static_cast<unsigned long>(exec.misses));
+    }
+    std::fprintf(stream, "aborts:   %llu\n", static_cast<unsigned long long>(stats.aborts));
+
+    auto policy = ConversionManager::getOverrunPolicy();
+    if (policy != OverrunPolicy::Abort) {
+        auto dropped = ConversionManager::getOverrunCounts()[static_cast<unsigned int>(policy)];
+        std::fprintf(stream, "dropped:  %lu\n", static_cast<unsigned long>(dropped));
+    }
+}
+
+} // namespace sim
+
+// Called by the idle thread: nothing is runnable, so skip ahead to the next
+// interrupt and let whatever it wakes up run.
+extern "C" void _sim_check_for_interrupts(void)
+{
+    sim::advanceTo(sim::nextEvent());
+
+    chSysLock();
+    chSchRescheduleS();
+    chSysUnlock();
+}
+
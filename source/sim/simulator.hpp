@@ -0,0 +1,55 @@
+/**
+ * @file simulator.hpp
+ * @brief Virtual-time engine for the host simulation build.
+ *
+ * Copyright (C) 2021 Clyne Sullivan
+ *
+ * Distributed under the GNU GPL v3 or later. You should have received a copy of
+ * the GNU General Public License along with this program.
+ * If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STMDSP_SIMULATOR_HPP
+#define STMDSP_SIMULATOR_HPP
+
+#include <cstdint>
+#include <cstdio>
+
+namespace sim
+{
+    // Virtual core clock used to report cycle counts (matches the L4).
+    constexpr uint64_t CORE_FREQUENCY = 80'000'000;
+
+    // Opens the sample files; a null path selects silence / no recording.
+    bool open(const char *input, const char *output);
+    // Sets the cost charged for each block, in virtual core cycles.
+    void setCycleModel(unsigned int perBlock, unsigned int perSample);
+    // Charges scaled host CPU time instead of the cycle model (e.g. 4.0 =
+    // target is 4x slower). Results then vary between runs and hosts.
+    void setCpuScale(double scale);
+    // Sets the value returned for the parameter knobs.
+    void setKnob(unsigned int id, uint16_t value);
+    uint16_t knob(unsigned int id);
+
+    // Called by the simulated ADC/DAC drivers on start and stop.
+    void adcStarted();
+    void adcStopped();
+
+    // Wraps an algorithm invocation on size samples: the block's cost is
+    // charged to the virtual clock, firing any interrupts that fall due.
+    // endBlock() returns the charged time in virtual core cycles.
+    void beginBlock(const void *samples, unsigned int size);
+    uint32_t endBlock();
+
+    // Returns the virtual time in core cycles.
+    uint32_t cycleCount();
+
+    // Called when the conversion manager aborts the algorithm.
+    void conversionAborted();
+
+    // Prints latency/overrun statistics to the given stream.
+    void report(FILE *stream);
+}
+
+#endif // STMDSP_SIMULATOR_HPP
+